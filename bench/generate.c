@@ -0,0 +1,116 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "generate.h"
+#include "practice.h"
+
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// xorshift64*, so a seed gives the same library everywhere
+static uint64_t next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(2685821657736338717);
+}
+
+static FILE *open_in(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return fopen(path, "w");
+}
+
+static int close_checked(FILE *file, int rc) {
+    if (fclose(file) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+// Legacy layout: the file's mtime is the practice time
+static int touch_legacy(const char *dir, uint32_t i, int64_t when) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/" PRACTICE_FILE_PREFIX "Piece %u", dir, i);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    struct timespec times[2] = { { (time_t)when, 0 }, { (time_t)when, 0 } };
+    int rc = futimens(fd, times);
+    return close(fd) == -1 ? -1 : rc;
+}
+
+int bench_generate(const char *dir, const struct bench_spec *spec, int64_t now) {
+    uint64_t state = spec->seed != 0 ? spec->seed : 1;
+    unsigned max_freq = spec->max_freq > 0 ? spec->max_freq : 1;
+
+    FILE *lib = open_in(dir, ".pif");
+    if (lib == NULL) {
+        return -1;
+    }
+    FILE *log = NULL;
+    if (!spec->legacy && (log = open_in(dir, PRACTICE_LOG_NAME)) == NULL) {
+        return close_checked(lib, -1);
+    }
+
+    int rc = 0;
+    for (uint32_t i = 0; i < spec->songs && rc == 0; i++) {
+        unsigned kind = (unsigned)(next(&state) % 100);
+        if (kind < spec->rot_pct) {
+            rc = fprintf(lib, "Piece %u rot\n", i) < 0 ? -1 : 0;
+        } else if (kind < spec->rot_pct + spec->freq_pct) {
+            unsigned freq = 1 + (unsigned)(next(&state) % max_freq);
+            rc = fprintf(lib, "Piece %u %u\n", i, freq) < 0 ? -1 : 0;
+            if (rc == 0 && next(&state) % 100 < spec->practiced_pct) {
+                int64_t when = now - (int64_t)(next(&state) % (2 * (uint64_t)max_freq * 86400));
+                rc = spec->legacy ? touch_legacy(dir, i, when)
+                                  : (fprintf(log, "%lld Piece %u\n", (long long)when, i) < 0 ? -1 : 0);
+            }
+        } else {
+            rc = fprintf(lib, "Piece %u\n", i) < 0 ? -1 : 0;
+        }
+    }
+    rc = close_checked(lib, rc);
+    if (log != NULL) {
+        rc = close_checked(log, rc);
+    }
+    if (rc == -1) {
+        return -1;
+    }
+
+    FILE *config = open_in(dir, ".pif-config");
+    if (config == NULL) {
+        return -1;
+    }
+    fprintf(config, "songs_per_day=%d\n", spec->songs_per_day);
+    fprintf(config, "last_played=%d\n", 0);
+    return close_checked(config, 0);
+}
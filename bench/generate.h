@@ -0,0 +1,44 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stdint.h>
+
+// Synthetic pif profiles for benchmarking: a .pif library, a .pif-config
+// and a practice history, written into one directory. The same spec and
+// seed always give the same files.
+struct bench_spec {
+    uint32_t songs;
+    unsigned rot_pct;        // Share of rotation songs
+    unsigned freq_pct;       // Share of frequency songs; the rest have none
+    unsigned practiced_pct;  // Share of frequency songs practiced before
+    unsigned max_freq;       // Frequencies are 1 to max_freq days
+    int songs_per_day;
+    int legacy;              // One .pif_last_practice_<song> file per song instead of the log
+    uint64_t seed;
+};
+
+#define BENCH_SPEC_INIT { 10000, 40, 50, 80, 14, 3, 0, 1 }
+
+// Write the profile into dir, which must exist. Practice times are spread
+// over the last 2 * max_freq days before now, so a realistic share of the
+// frequency songs is due. Returns 0 on success or -1 with errno set.
+int bench_generate(const char *dir, const struct bench_spec *spec, int64_t now);
+
+#endif
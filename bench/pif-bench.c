@@ -0,0 +1,322 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "generate.h"
+#include "libpif.h"
+#include "journal.h"
+#include "edit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+// pif-bench: time the core operations on generated libraries of the given
+// sizes. Every result is one JSON object per line on stdout, so runs from
+// different releases can be compared by a script:
+//
+//   {"rev":"v1.2-3-gabc","bench":"rotation","songs":100000,"practice":"log","runs":412,
+//    "ops":412000,"min_ns":41.2,"median_ns":43.0,"max_ns":80.1}
+//
+// Times are per operation. Progress goes to stderr.
+
+#ifndef PIF_BENCH_REV
+#define PIF_BENCH_REV ""
+#endif
+
+#define MIN_RUNS 3
+#define MAX_RUNS 10000
+#define BUDGET_NS 500000000ULL  // Per benchmark, once MIN_RUNS are done
+#define ROTATION_OPS 1000
+#define ROTATION_PER_DAY 3
+#define APPEND_OPS 1000
+#define COMPACT_RECORDS 100
+
+struct ctx {
+    char dir[PATH_MAX];
+    char fileloc[PATH_MAX];
+    char dbloc[PATH_MAX];
+    uint32_t songs;
+    int legacy;              // Practice times in per-song files, not the log
+    struct pif_library lib;  // Kept open for the read-only benchmarks
+    time_t now;
+    unsigned edits;
+};
+
+// One timed run: does ops operations and returns their total time
+typedef int (*bench_fn)(struct ctx *ctx, uint64_t *ns, uint64_t *ops);
+
+static void handle_error(const char *msg) {
+    fprintf(stderr, "Error: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int open_lib(struct ctx *ctx, struct pif_library *lib) {
+    return pif_library_open(lib, ctx->fileloc, ctx->dir);
+}
+
+// load_songs with no usable snapshot: parse ~/.pif and write .pifdb
+static int bench_open_cold(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_library lib;
+    unlink(ctx->dbloc);
+    uint64_t start = now_ns();
+    if (open_lib(ctx, &lib) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    pif_library_close(&lib);
+    return 0;
+}
+
+// load_songs through an up-to-date snapshot
+static int bench_open_warm(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_library lib;
+    uint64_t start = now_ns();
+    if (open_lib(ctx, &lib) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    pif_library_close(&lib);
+    return 0;
+}
+
+// get_todays_songs
+static int bench_rotation(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_config config = { ROTATION_PER_DAY, 0 };
+    uint32_t out[ROTATION_PER_DAY];
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < ROTATION_OPS; i++) {
+        pif_library_rotation(&ctx->lib, &config, out);
+    }
+    *ns = now_ns() - start;
+    *ops = ROTATION_OPS;
+    return 0;
+}
+
+// The is_song_due loop on a fresh library: builds the schedule and looks
+// up the practice times of the songs that look due
+static int bench_due_cold(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_library lib;
+    if (open_lib(ctx, &lib) == -1) {
+        return -1;
+    }
+    uint32_t *due;
+    uint32_t count;
+    uint64_t start = now_ns();
+    int rc = pif_library_due(&lib, ctx->now, &due, &count);
+    *ns = now_ns() - start;
+    *ops = 1;
+    if (rc == 0) {
+        free(due);
+    }
+    pif_library_close(&lib);
+    return rc;
+}
+
+// Later due queries, with the schedule built
+static int bench_due(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    uint32_t *due;
+    uint32_t count;
+    uint64_t start = now_ns();
+    if (pif_library_due(&ctx->lib, ctx->now, &due, &count) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    free(due);
+    return 0;
+}
+
+// Adding songs to an open library in memory, as pifd and pif-gtk do
+// before journaling them
+static int bench_append(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_library lib;
+    if (open_lib(ctx, &lib) == -1) {
+        return -1;
+    }
+    char line[64];
+    int rc = 0;
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < APPEND_OPS && rc == 0; i++) {
+        int len = snprintf(line, sizeof(line), "Added %u %u", i, 1 + i % 14);
+        rc = pif_library_append(&lib, line, (size_t)len);
+    }
+    *ns = now_ns() - start;
+    *ops = APPEND_OPS;
+    pif_library_close(&lib);
+    return rc;
+}
+
+// save_songs for one edit: a journal record
+static int bench_journal_append(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    char line[64];
+    int len = snprintf(line, sizeof(line), "Journal %u rot", ctx->edits++);
+    uint64_t start = now_ns();
+    if (pif_journal_append(ctx->fileloc, PIF_JOURNAL_ADD, 0, line, (size_t)len, NULL) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    return 0;
+}
+
+// save_songs for a burst of edits: folding the journal into ~/.pif
+static int bench_compact(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    struct pif_journal_record records[COMPACT_RECORDS];
+    char lines[COMPACT_RECORDS][64];
+    for (unsigned i = 0; i < COMPACT_RECORDS; i++) {
+        int len = snprintf(lines[i], sizeof(lines[i]), "Compact %u 7", ctx->edits++);
+        records[i] = (struct pif_journal_record){ PIF_JOURNAL_ADD, 0, lines[i], (size_t)len };
+    }
+    if (pif_journal_append_all(ctx->fileloc, records, COMPACT_RECORDS, NULL) == -1) {
+        return -1;
+    }
+    uint64_t start = now_ns();
+    if (pif_journal_compact(ctx->fileloc, ctx->dir) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    return 0;
+}
+
+// ins_txt: text spliced into the middle line in place, which is
+// pif_edit_splice, the same call pif's ins_txt makes
+static int bench_edit(struct ctx *ctx, uint64_t *ns, uint64_t *ops) {
+    const char *text = ctx->edits++ % 2 ? "Pie" : "Tun";
+    uint64_t start = now_ns();
+    if (pif_edit_splice(ctx->fileloc, ctx->dir, ctx->songs / 2, 0, 3, text, 3) == -1) {
+        return -1;
+    }
+    *ns = now_ns() - start;
+    *ops = 1;
+    return 0;
+}
+
+static void run(struct ctx *ctx, const char *name, bench_fn fn) {
+    static double per_op[MAX_RUNS];
+    uint64_t total = 0, ops = 0;
+    unsigned runs = 0;
+    while (runs < MIN_RUNS || (total < BUDGET_NS && runs < MAX_RUNS)) {
+        uint64_t ns, n;
+        if (fn(ctx, &ns, &n) == -1) {
+            fprintf(stderr, "Error: %s at %u songs failed: %s\n", name, ctx->songs, strerror(errno));
+            exit(1);
+        }
+        per_op[runs++] = (double)ns / (double)n;
+        total += ns;
+        ops += n;
+    }
+    qsort(per_op, runs, sizeof(per_op[0]), cmp_double);
+    printf("{\"rev\":\"%s\",\"bench\":\"%s\",\"songs\":%u,\"practice\":\"%s\",\"runs\":%u,\"ops\":%llu,"
+           "\"min_ns\":%.1f,\"median_ns\":%.1f,\"max_ns\":%.1f}\n",
+           PIF_BENCH_REV, name, ctx->songs, ctx->legacy ? "legacy" : "log", runs, (unsigned long long)ops, per_op[0],
+           per_op[runs / 2], per_op[runs - 1]);
+    fflush(stdout);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;    // Suppress unused parameter warning
+    (void)flag;  // Suppress unused parameter warning
+    (void)ftw;   // Suppress unused parameter warning
+    return remove(path);
+}
+
+static void bench_size(uint32_t songs, int legacy) {
+    struct ctx ctx = { .songs = songs, .legacy = legacy, .now = time(NULL) };
+    const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(ctx.dir, sizeof(ctx.dir), "%s/pif-bench.XXXXXX", tmp);
+    if (mkdtemp(ctx.dir) == NULL) {
+        handle_error("Failed to create bench directory");
+    }
+    snprintf(ctx.fileloc, sizeof(ctx.fileloc), "%s/.pif", ctx.dir);
+    snprintf(ctx.dbloc, sizeof(ctx.dbloc), "%sdb", ctx.fileloc);
+
+    struct bench_spec spec = BENCH_SPEC_INIT;
+    spec.songs = songs;
+    spec.legacy = legacy;
+    fprintf(stderr, "Generating %u songs in %s\n", songs, ctx.dir);
+    if (bench_generate(ctx.dir, &spec, (int64_t)ctx.now) == -1) {
+        handle_error("Failed to generate library");
+    }
+
+    run(&ctx, "open_cold", bench_open_cold);
+    run(&ctx, "open_warm", bench_open_warm);
+    if (open_lib(&ctx, &ctx.lib) == -1) {
+        handle_error("Failed to open library");
+    }
+    run(&ctx, "rotation", bench_rotation);
+    run(&ctx, "due_cold", bench_due_cold);
+    uint64_t ns, ops;
+    if (bench_due(&ctx, &ns, &ops) == -1) {  // Build the schedule first
+        handle_error("Failed to check practice history");
+    }
+    run(&ctx, "due", bench_due);
+    pif_library_close(&ctx.lib);
+    run(&ctx, "append", bench_append);
+
+    // These change the library, so they come last
+    run(&ctx, "journal_append", bench_journal_append);
+    run(&ctx, "compact", bench_compact);
+    run(&ctx, "edit", bench_edit);
+
+    if (nftw(ctx.dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS) == -1) {
+        handle_error("Failed to remove bench directory");
+    }
+}
+
+int main(int argc, char **argv) {
+    int legacy = 0;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "--legacy") == 0) {
+        legacy = 1;
+        i++;
+    }
+    if (i == argc) {
+        fprintf(stderr, "Usage: pif-bench [--legacy] SONGS...\n");
+        return 1;
+    }
+    for (; i < argc; i++) {
+        char *end;
+        errno = 0;
+        unsigned long songs = strtoul(argv[i], &end, 10);
+        if (errno != 0 || end == argv[i] || *end != '\0' || songs < 1 || songs > UINT32_MAX - 1) {
+            fprintf(stderr, "Error: Bad library size: %s\n", argv[i]);
+            return 1;
+        }
+        bench_size((uint32_t)songs, legacy);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "generate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+
+// pif-gen: write a synthetic profile into a directory, e.g. to try
+// pif --batch on large libraries
+
+static void usage(void) {
+    fprintf(stderr, "Usage: pif-gen [--songs N] [--rot PCT] [--freq PCT] [--practiced PCT] [--max-freq DAYS]\n"
+                    "               [--per-day N] [--legacy] [--seed N] DIR\n");
+    exit(1);
+}
+
+static unsigned long number(const char *arg, unsigned long max) {
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || n > max) {
+        usage();
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    struct bench_spec spec = BENCH_SPEC_INIT;
+    int i = 1;
+    for (; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--legacy") == 0) {
+            spec.legacy = 1;
+        } else if (i + 2 >= argc) {
+            usage();
+        } else if (strcmp(argv[i], "--songs") == 0) {
+            spec.songs = (uint32_t)number(argv[++i], UINT32_MAX - 1);
+        } else if (strcmp(argv[i], "--rot") == 0) {
+            spec.rot_pct = (unsigned)number(argv[++i], 100);
+        } else if (strcmp(argv[i], "--freq") == 0) {
+            spec.freq_pct = (unsigned)number(argv[++i], 100);
+        } else if (strcmp(argv[i], "--practiced") == 0) {
+            spec.practiced_pct = (unsigned)number(argv[++i], 100);
+        } else if (strcmp(argv[i], "--max-freq") == 0) {
+            spec.max_freq = (unsigned)number(argv[++i], 999999999);
+        } else if (strcmp(argv[i], "--per-day") == 0) {
+            spec.songs_per_day = (int)number(argv[++i], 1000000);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            spec.seed = number(argv[++i], ULONG_MAX);
+        } else {
+            usage();
+        }
+    }
+    if (i != argc - 1 || spec.rot_pct + spec.freq_pct > 100) {
+        usage();
+    }
+
+    if (bench_generate(argv[i], &spec, (int64_t)time(NULL)) == -1) {
+        fprintf(stderr, "Error: Failed to write profile: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
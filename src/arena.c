@@ -0,0 +1,121 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE
+#include "arena.h"
+#include "trace.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct pif_arena_chunk {
+    struct pif_arena_chunk *next;
+    size_t used;
+    size_t size;  // Of the whole mapping, header included
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+static struct pif_arena_chunk *new_chunk(struct pif_arena *arena, size_t need) {
+    size_t size = arena->head != NULL ? arena->head->size * 2 : ARENA_MIN_CHUNK;
+    if (need > SIZE_MAX / 2 - sizeof(struct pif_arena_chunk)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    while (size - sizeof(struct pif_arena_chunk) < need) {
+        size *= 2;
+    }
+    struct pif_arena_chunk *chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+        return NULL;
+    }
+    pif_trace_arena((int64_t)size);
+    chunk->next = arena->head;
+    chunk->used = 0;
+    chunk->size = size;
+    arena->head = chunk;
+    return chunk;
+}
+
+void *pif_arena_alloc(struct pif_arena *arena, size_t size) {
+    size_t rounded = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (rounded < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    struct pif_arena_chunk *chunk = arena->head;
+    if (chunk == NULL || chunk->size - sizeof(*chunk) - chunk->used < rounded) {
+        if ((chunk = new_chunk(arena, rounded)) == NULL) {
+            return NULL;
+        }
+    }
+    void *p = chunk->data + chunk->used;
+    chunk->used += rounded;
+    return p;
+}
+
+void *pif_arena_calloc(struct pif_arena *arena, size_t n, size_t size) {
+    if (size != 0 && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = pif_arena_alloc(arena, n * size);
+    if (p != NULL) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+char *pif_arena_strndup(struct pif_arena *arena, const char *s, size_t len) {
+    char *p = pif_arena_alloc(arena, len + 1);
+    if (p != NULL) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+void pif_arena_reset(struct pif_arena *arena) {
+    struct pif_arena_chunk *keep = arena->head;
+    if (keep == NULL) {
+        return;
+    }
+    struct pif_arena_chunk *chunk = keep->next;
+    while (chunk != NULL) {
+        struct pif_arena_chunk *next = chunk->next;
+        pif_trace_arena(-(int64_t)chunk->size);
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+}
+
+void pif_arena_free(struct pif_arena *arena) {
+    pif_arena_reset(arena);
+    if (arena->head != NULL) {
+        pif_trace_arena(-(int64_t)arena->head->size);
+        munmap(arena->head, arena->head->size);
+        arena->head = NULL;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for data that lives exactly as long as one run of pif:
+// everything is released together by pif_arena_free, or kept for the next
+// run by pif_arena_reset. Chunks come straight from mmap and double in
+// size, so a run makes O(log bytes) allocations and leaves no holes in
+// the malloc heap however many runs a process does.
+struct pif_arena_chunk;
+
+struct pif_arena {
+    struct pif_arena_chunk *head;  // Newest and largest chunk first
+};
+
+#define PIF_ARENA_INIT { NULL }
+
+// size bytes aligned for any type, or NULL with errno set. Memory from a
+// fresh chunk is zeroed, reused memory is not.
+void *pif_arena_alloc(struct pif_arena *arena, size_t size);
+
+// Zeroed array of n elements of size bytes
+void *pif_arena_calloc(struct pif_arena *arena, size_t n, size_t size);
+
+// Copy of s, NUL-terminated
+char *pif_arena_strndup(struct pif_arena *arena, const char *s, size_t len);
+
+// Release everything but the largest chunk, which the next run starts in
+void pif_arena_reset(struct pif_arena *arena);
+void pif_arena_free(struct pif_arena *arena);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "batch.h"
+#include "libpif.h"
+#include "state.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+struct batch_result {
+    char *text;
+    size_t len;
+    const char *what;  // NULL on success
+    int err;
+    int done;
+};
+
+struct batch {
+    char *const *dirs;
+    size_t count;
+    int peek;
+    atomic_size_t next;
+    struct batch_result *results;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static int profile_path(char *buf, const char *dir, const char *name) {
+    int len = snprintf(buf, PATH_MAX, "%s/%s", dir, name);
+    if (len < 0 || len >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+// fsuid and fsgid are per thread, so each worker can take on the owner of
+// the profile it is working on. Files it creates then belong to the
+// student, and links in their home cannot send root's writes elsewhere.
+static int become_owner(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) == -1) {
+        return -1;
+    }
+    setfsgid(st.st_gid);
+    setfsuid(st.st_uid);
+    if ((uid_t)setfsuid((uid_t)-1) != st.st_uid || (gid_t)setfsgid((gid_t)-1) != st.st_gid) {
+        errno = EPERM;
+        return -1;
+    }
+    return 0;
+}
+
+static void become_root(void) {
+    setfsuid(0);
+    setfsgid(0);
+}
+
+// Everything the run allocates comes from run, which the caller resets
+static int run_profile(const char *dir, int peek, struct pif_arena *run, FILE *out, const char **what) {
+    char fileloc[PATH_MAX], configloc[PATH_MAX], stateloc[PATH_MAX];
+    if (profile_path(fileloc, dir, ".pif") == -1 || profile_path(configloc, dir, ".pif-config") == -1 ||
+        profile_path(stateloc, dir, PIF_STATE_NAME) == -1) {
+        *what = "Path too long";
+        return -1;
+    }
+
+    struct pif_library lib;
+    if (pif_library_open_run(&lib, fileloc, dir, run) == -1) {
+        *what = "Failed to open songs file";
+        return -1;
+    }
+    struct pif_state state;
+    if (pif_state_open(&state, stateloc, configloc) == -1) {
+        *what = "Failed to open rotation state";
+        goto fail_lib;
+    }
+
+    struct pif_config config;
+    if (peek) {
+        pif_state_read(&state, &config);
+    } else if (pif_state_begin(&state, &config) == -1) {
+        *what = "Failed to lock rotation state";
+        goto fail_state;
+    }
+    uint32_t *rotation =
+        pif_arena_alloc(run, (config.songs_per_day > 0 ? config.songs_per_day : 1) * sizeof(*rotation));
+    if (rotation == NULL) {
+        if (!peek) {
+            pif_state_abort(&state);
+        }
+        *what = "Memory allocation failed";
+        goto fail_state;
+    }
+    uint32_t num_rotation = pif_library_rotation(&lib, &config, rotation);
+    if (!peek && pif_state_commit(&state, &config) == -1) {
+        *what = "Failed to save rotation state";
+        goto fail_state;
+    }
+    pif_print_rotation(out, &lib, rotation, num_rotation);
+
+    if (!peek) {
+        uint32_t *due;
+        uint32_t num_due;
+        if (pif_library_due(&lib, time(NULL), &due, &num_due) == -1) {
+            *what = "Failed to check practice history";
+            goto fail_state;
+        }
+        if (num_due > 0) {
+            fputc('\n', out);
+        }
+        pif_print_due(out, &lib, due, num_due);
+    }
+
+    pif_state_close(&state);
+    pif_library_close(&lib);
+    return 0;
+
+fail_state:;
+    int saved = errno;
+    pif_state_close(&state);
+    errno = saved;
+fail_lib:
+    saved = errno;
+    pif_library_close(&lib);
+    errno = saved;
+    return -1;
+}
+
+static void *worker(void *data) {
+    struct batch *batch = data;
+    int as_root = geteuid() == 0;
+
+    // Reused from one profile to the next, so a long batch settles on a
+    // single mapping instead of churning the heap
+    struct pif_arena run = PIF_ARENA_INIT;
+    for (;;) {
+        size_t i = atomic_fetch_add_explicit(&batch->next, 1, memory_order_relaxed);
+        if (i >= batch->count) {
+            break;
+        }
+        struct batch_result r = { NULL, 0, NULL, 0, 1 };
+        FILE *out = open_memstream(&r.text, &r.len);
+        if (out == NULL) {
+            r.what = "Memory allocation failed";
+        } else if (as_root && become_owner(batch->dirs[i]) == -1) {
+            r.what = "Failed to switch to the profile's owner";
+        } else {
+            run_profile(batch->dirs[i], batch->peek, &run, out, &r.what);
+        }
+        r.err = errno;
+        pif_arena_reset(&run);
+        if (as_root) {
+            become_root();
+        }
+        if (out != NULL && fclose(out) == EOF && r.what == NULL) {
+            r.what = "Memory allocation failed";
+            r.err = errno;
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        batch->results[i] = r;
+        pthread_cond_signal(&batch->cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    pif_arena_free(&run);
+    return NULL;
+}
+
+size_t pif_batch_run(char *const *dirs, size_t count, int peek, unsigned jobs, FILE *out) {
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (jobs > PIF_BATCH_MAX_JOBS) {
+        jobs = PIF_BATCH_MAX_JOBS;
+    }
+    if (jobs > count) {
+        jobs = (unsigned)count;
+    }
+
+    struct batch batch = { dirs, count, peek, 0, calloc(count ? count : 1, sizeof(struct batch_result)),
+                           PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+    pthread_t *threads = malloc((jobs ? jobs : 1) * sizeof(*threads));
+    if (batch.results == NULL || threads == NULL) {
+        free(batch.results);
+        free(threads);
+        fprintf(stderr, "Error: Memory allocation failed: %s\n", strerror(errno));
+        return count;
+    }
+    unsigned started = 0;
+    while (started < jobs && pthread_create(&threads[started], NULL, worker, &batch) == 0) {
+        started++;
+    }
+    if (started == 0 && count > 0) {
+        worker(&batch);  // No threads to be had, so do it all here
+    }
+
+    // Print each profile as soon as it and everything before it is done
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        pthread_mutex_lock(&batch.lock);
+        while (!batch.results[i].done) {
+            pthread_cond_wait(&batch.cond, &batch.lock);
+        }
+        struct batch_result r = batch.results[i];
+        pthread_mutex_unlock(&batch.lock);
+
+        if (r.what != NULL) {
+            fprintf(stderr, "Error: %s: %s: %s\n", dirs[i], r.what, strerror(r.err));
+            failed++;
+        } else {
+            fprintf(out, "%s==> %s <==\n", i > 0 ? "\n" : "", dirs[i]);
+            fwrite(r.text, 1, r.len, out);
+        }
+        free(r.text);
+    }
+
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(batch.results);
+    return failed;
+}
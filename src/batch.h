@@ -0,0 +1,38 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Batch mode for running pif over a whole studio: every profile directory
+// holds its own .pif, rotation state and practice history, and profiles
+// are worked on in parallel by a pool of threads. Output still comes out
+// whole per profile and in the order given. Run as root, each profile is
+// read and written with its owner's file permissions.
+#define PIF_BATCH_MAX_JOBS 256
+
+// Run today's list (or with peek, only show the rotation, like --rotation)
+// for count profile directories on jobs threads, 0 for one per CPU. Each
+// profile's output goes to out under a "==> dir <==" header and its
+// rotation advances atomically on its own. Failures are reported on
+// stderr. Returns the number of profiles that failed.
+size_t pif_batch_run(char *const *dirs, size_t count, int peek, unsigned jobs, FILE *out);
+
+#endif
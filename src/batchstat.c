@@ -0,0 +1,274 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "batchstat.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#define RING_ENTRIES 256
+#define MAX_THREADS 16
+#define PATHS_PER_THREAD 64
+
+// Minimal io_uring ring, set up with raw syscalls so we need no liburing
+struct ring {
+    int fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+};
+
+static void ring_close(struct ring *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    close(ring->fd);
+}
+
+static int ring_open(struct ring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd == -1) {
+        return -1;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        ring_close(ring);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            ring_close(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring_close(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring->entries = p.sq_entries;
+    return 0;
+}
+
+// Submit every statx through the ring, a ring's worth at a time, and
+// wait for each chunk, normally with a single io_uring_enter
+static int uring_mtime(const char *const *paths, size_t count, int64_t *mtimes) {
+    struct ring ring;
+    unsigned want = count < RING_ENTRIES ? (unsigned)count : RING_ENTRIES;
+    if (ring_open(&ring, want) == -1) {
+        return -1;
+    }
+
+    struct statx *bufs = malloc(ring.entries * sizeof(*bufs));
+    if (bufs == NULL) {
+        ring_close(&ring);
+        return -1;
+    }
+
+    int rc = 0;
+    int in_flight = 0;
+    for (size_t base = 0; base < count && rc == 0; base += ring.entries) {
+        unsigned n = count - base < ring.entries ? (unsigned)(count - base) : ring.entries;
+
+        unsigned tail = *ring.sq_tail;
+        for (unsigned i = 0; i < n; i++) {
+            unsigned idx = tail & *ring.sq_mask;
+            struct io_uring_sqe *sqe = &ring.sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)paths[base + i];
+            sqe->len = STATX_MTIME;
+            sqe->off = (uint64_t)(uintptr_t)&bufs[i];
+            sqe->user_data = i;
+            ring.sq_array[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        // The kernel may take fewer SQEs than offered; keep offering the rest,
+        // and only wait for completions of those it has taken
+        unsigned done = 0;
+        unsigned submit = n;
+        while (done < n) {
+            unsigned wait = n - submit - done;
+            int ret = (int)syscall(__NR_io_uring_enter, ring.fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                rc = -1;
+                in_flight = 1;
+                break;
+            }
+            if (ret == 0 && submit > 0 && wait == 0) {
+                rc = -1;  // Nothing taken and nothing to wait for: no progress possible
+                break;
+            }
+            submit -= (unsigned)ret;
+
+            unsigned head = *ring.cq_head;
+            unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != cq_tail; head++, done++) {
+                const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+                size_t i = (size_t)cqe->user_data;
+                if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+                    rc = -1;  // Kernel without IORING_OP_STATX
+                } else if (cqe->res < 0) {
+                    mtimes[base + i] = 0;
+                } else {
+                    mtimes[base + i] = bufs[i].stx_mtime.tv_sec;
+                }
+            }
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    // If io_uring_enter itself failed, statx calls may still be in flight
+    // and writing to bufs, so it is deliberately leaked in that case
+    if (!in_flight) {
+        free(bufs);
+    }
+    ring_close(&ring);
+    if (rc == -1) {
+        errno = ENOSYS;
+    }
+    return rc;
+}
+
+struct stat_job {
+    const char *const *paths;
+    int64_t *mtimes;
+    size_t count;
+    size_t first;
+    size_t stride;
+};
+
+static void *stat_worker(void *arg) {
+    const struct stat_job *job = arg;
+    for (size_t i = job->first; i < job->count; i += job->stride) {
+        struct stat st;
+        job->mtimes[i] = stat(job->paths[i], &st) == 0 ? st.st_mtime : 0;
+    }
+    return NULL;
+}
+
+// Fallback: plain stat() spread over a bounded number of threads
+static int threaded_mtime(const char *const *paths, size_t count, int64_t *mtimes) {
+    size_t nthreads = count / PATHS_PER_THREAD + 1;
+    if (nthreads > MAX_THREADS) {
+        nthreads = MAX_THREADS;
+    }
+
+    pthread_t threads[MAX_THREADS];
+    struct stat_job jobs[MAX_THREADS];
+    size_t started = 0;
+    for (size_t t = 0; t < nthreads; t++) {
+        jobs[t] = (struct stat_job){ paths, mtimes, count, t, nthreads };
+        if (t == 0 || pthread_create(&threads[t], NULL, stat_worker, &jobs[t]) != 0) {
+            continue;
+        }
+        started |= (size_t)1 << t;
+    }
+
+    // Whatever could not get its own thread runs here
+    for (size_t t = 0; t < nthreads; t++) {
+        if (!(started & ((size_t)1 << t))) {
+            stat_worker(&jobs[t]);
+        }
+    }
+    for (size_t t = 0; t < nthreads; t++) {
+        if (started & ((size_t)1 << t)) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    return 0;
+}
+
+int batch_mtime(const char *const *paths, size_t count, int64_t *mtimes) {
+    pif_trace_stats((unsigned)count);
+    if (count == 0) {
+        return 0;
+    }
+    if (uring_mtime(paths, count, mtimes) == 0) {
+        return 0;
+    }
+    return threaded_mtime(paths, count, mtimes);
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHSTAT_H
+#define BATCHSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Look up the mtime of many files at once. mtimes[i] is set to the mtime
+// of paths[i], or 0 if it cannot be stat'ed. All lookups are submitted as
+// one io_uring batch where the kernel allows it, otherwise they are spread
+// over a small pool of threads. Returns 0 on success or -1 with errno set.
+int batch_mtime(const char *const *paths, size_t count, int64_t *mtimes);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "edit.h"
+#include "journal.h"
+#include "pifdb.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define EDIT_MAGIC "pif-edit"
+
+static int edit_path(char *buf, size_t size, const char *fileloc) {
+    int len = snprintf(buf, size, "%s" PIF_EDIT_SUFFIX, fileloc);
+    if (len < 0 || (size_t)len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return 0;
+}
+
+// Write tail at off and cut the file there
+static int apply_tail(const char *fileloc, const char *tail, size_t len, off_t off) {
+    int fd = open(fileloc, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int rc = pwrite_all(fd, tail, len, off) == 0 && ftruncate(fd, off + (off_t)len) == 0 && fsync(fd) == 0
+                 ? 0
+                 : -1;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
+
+int pif_edit_recover_locked(const char *fileloc) {
+    char path[PATH_MAX];
+    if (edit_path(path, sizeof(path), fileloc) == -1) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    int rc = 0;
+    struct stat st;
+    char *buf = NULL;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1 || (buf = malloc((size_t)st.st_size + 1)) == NULL) {
+        rc = -1;
+        goto out;
+    }
+    ssize_t got = pread(fd, buf, (size_t)st.st_size, 0);
+    if (got != st.st_size) {
+        rc = -1;
+        goto out;
+    }
+    buf[got] = '\0';
+
+    // A backup that is not complete was never acted on: ~/.pif is intact
+    long long off, len;
+    int header_len;
+    if (sscanf(buf, EDIT_MAGIC " %lld %lld\n%n", &off, &len, &header_len) == 2 && header_len > 0 &&
+        (long long)got - header_len == len) {
+        rc = apply_tail(fileloc, buf + header_len, (size_t)len, (off_t)off);
+    }
+    if (rc == 0) {
+        unlink(path);
+    }
+
+out:;
+    int saved = errno;
+    free(buf);
+    close(fd);
+    errno = saved;
+    return rc;
+}
+
+int pif_edit_recover(const char *fileloc) {
+    char path[PATH_MAX];
+    if (edit_path(path, sizeof(path), fileloc) == -1) {
+        return -1;
+    }
+    // Every open of ~/.pif comes through here, so only lock when there is
+    // something to do; a backup may also be a splice still in progress,
+    // and the lock waits for it to finish
+    pif_trace_stats(1);
+    if (access(path, F_OK) == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    int lock = pif_journal_lock(fileloc);
+    if (lock == -1) {
+        return -1;
+    }
+    int rc = pif_edit_recover_locked(fileloc);
+    int saved = errno;
+    pif_journal_unlock(lock);
+    errno = saved;
+    return rc;
+}
+
+// Save the new tail next to ~/.pif before touching it
+static int write_backup(const char *path, const char *tail, size_t len, off_t off) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), EDIT_MAGIC " %lld %lld\n", (long long)off, (long long)len);
+    int rc = pwrite_all(fd, header, (size_t)header_len, 0) == 0 &&
+             pwrite_all(fd, tail, len, header_len) == 0 && fsync(fd) == 0
+                 ? 0
+                 : -1;
+    int saved = errno;
+    close(fd);
+    if (rc == -1) {
+        unlink(path);
+    }
+    errno = saved;
+    return rc;
+}
+
+// Call with the lock held, so no append lands between folding in the
+// journal and rewriting the lines its rows refer to
+static int splice_locked(const char *fileloc, const char *practice_dir, uint32_t line, size_t start, size_t remove,
+                         const char *text, size_t len) {
+    char path[PATH_MAX];
+    if (edit_path(path, sizeof(path), fileloc) == -1 || pif_edit_recover_locked(fileloc) == -1) {
+        return -1;
+    }
+
+    // Journal rows refer to the current lines, so fold it in first
+    char journal[PATH_MAX];
+    struct stat st;
+    int len_journal = snprintf(journal, sizeof(journal), "%s" PIF_JOURNAL_SUFFIX, fileloc);
+    if (len_journal < 0 || (size_t)len_journal >= sizeof(journal)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int stale = 0;
+    pif_trace_stats(1);
+    if (stat(journal, &st) == 0 && (stale = pif_journal_compact_locked(fileloc, practice_dir)) == -1) {
+        return -1;
+    }
+
+    struct practice_source practice;
+    practice_source_init(&practice, practice_dir);
+    struct pifdb db;
+    if (pifdb_open(&db, fileloc, &practice) == -1) {
+        int saved = errno;
+        practice_source_close(&practice);
+        errno = saved;
+        return -1;
+    }
+    off_t size = (off_t)db.hdr->source_size;
+    int in_range = line < db.count && start + remove <= db.line_len[line];
+    off_t off = in_range ? (off_t)(db.line_off[line] + start) : 0;
+    pifdb_close(&db);
+    practice_source_close(&practice);
+    if (!in_range) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    // Only the file from the edit onwards changes
+    size_t old_tail = (size_t)(size - off) - remove;
+    size_t new_len = len + old_tail;
+    char *tail = malloc(new_len ? new_len : 1);
+    if (tail == NULL) {
+        return -1;
+    }
+    memcpy(tail, text, len);
+
+    int rc = -1;
+    int fd = open(fileloc, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        goto out;
+    }
+    ssize_t got = pread(fd, tail + len, old_tail, off + (off_t)remove);
+    close(fd);
+    if (got != (ssize_t)old_tail) {
+        if (got >= 0) {
+            errno = EIO;
+        }
+        goto out;
+    }
+
+    if (write_backup(path, tail, new_len, off) == -1) {
+        goto out;
+    }
+    if (apply_tail(fileloc, tail, new_len, off) == -1) {
+        goto out;  // Leave the backup for pif_edit_recover
+    }
+    unlink(path);
+    rc = stale;
+
+out:;
+    int saved = errno;
+    free(tail);
+    errno = saved;
+    return rc;
+}
+
+static int splice_tail(const char *fileloc, const char *practice_dir, uint32_t line, size_t start, size_t remove,
+                       const char *text, size_t len) {
+    int lock = pif_journal_lock(fileloc);
+    if (lock == -1) {
+        return -1;
+    }
+    int rc = splice_locked(fileloc, practice_dir, line, start, remove, text, len);
+    int saved = errno;
+    pif_journal_unlock(lock);
+    errno = saved;
+    return rc;
+}
+
+int pif_edit_splice(const char *fileloc, const char *practice_dir, uint32_t line, size_t start, size_t remove,
+                    const char *text, size_t len) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = splice_tail(fileloc, practice_dir, line, start, remove, text, len);
+    pif_trace_end(&span, PIF_PHASE_SAVE);
+    return rc;
+}
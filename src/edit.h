@@ -0,0 +1,43 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EDIT_H
+#define EDIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-place edits of ~/.pif. The snapshot's line offsets locate the line
+// directly, and only the file from that point on is rewritten. The new
+// tail is first saved to ~/.pif.edit, so a crash part way through the
+// rewrite is finished by the next pif_edit_recover.
+#define PIF_EDIT_SUFFIX ".edit"
+
+// Replace remove bytes at offset start within line (0-based) with text.
+// Any edit journal is folded in first so its rows stay valid. Returns the
+// number of stale journal records set aside, normally 0, or -1 with
+// errno set; ERANGE if the line or span is not in the file.
+int pif_edit_splice(const char *fileloc, const char *practice_dir, uint32_t line, size_t start, size_t remove,
+                    const char *text, size_t len);
+
+// Finish an edit interrupted by a crash, if there is one. Like the splice
+// itself this takes the journal lock; the _locked form is for a caller
+// that holds it already.
+int pif_edit_recover(const char *fileloc);
+int pif_edit_recover_locked(const char *fileloc);
+
+#endif
@@ -0,0 +1,709 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "import.h"
+#include "libpif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+// Files a directory walk takes for songs: scores, tabs and recordings
+static const char *const song_extensions[] = {
+    "pdf", "mscz", "mscx", "musicxml", "mxl", "xml", "ly", "abc", "sib", "mus", "musx", "gp", "gp3", "gp4",
+    "gp5", "gpx", "tg", "mid", "midi", "mp3", "flac", "ogg", "oga", "opus", "wav", "m4a", "aac", "aiff", "aif",
+    "wma",
+};
+
+size_t pif_import_normalize(char *out, const char *name, size_t len) {
+    const unsigned char *s = (const unsigned char *)name;
+    size_t n = 0;
+    int gap = 0;
+    for (size_t i = 0; i < len; i++) {
+        // Control characters and no-break spaces count as whitespace
+        if (s[i] <= ' ' || s[i] == 0x7f) {
+            gap = n > 0;
+            continue;
+        }
+        if (s[i] == 0xc2 && i + 1 < len && s[i + 1] == 0xa0) {
+            gap = n > 0;
+            i++;
+            continue;
+        }
+        if (gap) {
+            out[n++] = '_';
+            gap = 0;
+        }
+        out[n++] = (char)s[i];
+    }
+    return n;
+}
+
+static int push(struct pif_import *import, const char *line, uint32_t len) {
+    if (import->count == import->capacity) {
+        size_t capacity = import->capacity ? import->capacity * 2 : 1024;
+        const char **lines = realloc(import->lines, capacity * sizeof(*lines));
+        if (lines == NULL) {
+            return -1;
+        }
+        import->lines = lines;
+        uint32_t *lens = realloc(import->lens, capacity * sizeof(*lens));
+        if (lens == NULL) {
+            return -1;
+        }
+        import->lens = lens;
+        import->capacity = capacity;
+    }
+    import->lines[import->count] = line;
+    import->lens[import->count] = len;
+    import->count++;
+    return 0;
+}
+
+// Add a song under the normalized name, with freq if it is one pif knows
+// and the import's default otherwise. A name with nothing left is skipped.
+static int add_song(struct pif_import *import, const char *name, size_t len, const char *freq, size_t freq_len) {
+    if (freq_len == 0 || pif_parse_freq(freq, freq_len) == PIF_FREQ_NONE) {
+        freq = import->freq;
+        freq_len = freq != NULL ? strlen(freq) : 0;
+    }
+    if (len + freq_len + 1 > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    char *line = pif_arena_alloc(&import->text, len + freq_len + 2);
+    if (line == NULL) {
+        return -1;
+    }
+    size_t n = pif_import_normalize(line, name, len);
+    if (n == 0) {
+        return 0;
+    }
+    if (freq_len > 0) {
+        line[n++] = ' ';
+        memcpy(line + n, freq, freq_len);
+        n += freq_len;
+    }
+    line[n] = '\0';
+    return push(import, line, (uint32_t)n);
+}
+
+static int has_extension(const char *name, size_t len, const char *ext) {
+    size_t n = strlen(ext);
+    return len > n + 1 && name[len - n - 1] == '.' && strncasecmp(name + len - n, ext, n) == 0;
+}
+
+// File name of a path or URL without its directory, query or extension
+static void file_stem(const char *path, size_t len, const char **stem, size_t *stem_len) {
+    const char *end = memchr(path, '?', len);
+    if (end == NULL || strstr(path, "://") == NULL) {
+        end = path + len;
+    }
+    const char *start = end;
+    while (start > path && start[-1] != '/' && start[-1] != '\\') {
+        start--;
+    }
+    const char *dot = memrchr(start, '.', (size_t)(end - start));
+    if (dot != NULL && dot > start) {
+        end = dot;
+    }
+    *stem = start;
+    *stem_len = (size_t)(end - start);
+}
+
+static int hex_digit(char c) {
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// Decode a URL's %XX escapes in place, returning the new length
+static size_t url_decode(char *s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        int hi, lo;
+        if (s[i] == '%' && i + 2 < len && (hi = hex_digit(s[i + 1])) >= 0 && (lo = hex_digit(s[i + 2])) >= 0) {
+            s[n++] = (char)(hi << 4 | lo);
+            i += 2;
+        } else {
+            s[n++] = s[i];
+        }
+    }
+    return n;
+}
+
+static void chomp(char *line, ssize_t *len) {
+    while (*len > 0 && (line[*len - 1] == '\n' || line[*len - 1] == '\r')) {
+        line[--*len] = '\0';
+    }
+}
+
+static int read_m3u(struct pif_import *import, FILE *in) {
+    char *line = NULL, *title = NULL;
+    size_t size = 0, title_len = 0;
+    ssize_t len;
+    int rc = 0;
+    while (rc == 0 && (len = getline(&line, &size, in)) != -1) {
+        chomp(line, &len);
+        if (strncmp(line, "#EXTINF:", 8) == 0) {
+            // The title follows the first comma outside the attributes'
+            // quotes: #EXTINF:-1 tvg-name="a,b",Title
+            int quoted = 0;
+            const char *p = line + 8;
+            for (; *p != '\0' && (quoted || *p != ','); p++) {
+                quoted ^= *p == '"';
+            }
+            free(title);
+            title = NULL;
+            if (*p == ',' && (title = strdup(p + 1)) == NULL) {
+                rc = -1;
+            }
+            title_len = title != NULL ? strlen(title) : 0;
+            continue;
+        }
+        if (line[0] == '#' || len == 0) {
+            continue;
+        }
+
+        const char *name = title;
+        size_t name_len = title != NULL ? pif_import_normalize(title, title, title_len) : 0;
+        if (name_len == 0) {
+            file_stem(line, (size_t)len, &name, &name_len);
+            if (strstr(line, "://") != NULL) {
+                name_len = url_decode(line + (name - line), name_len);
+            }
+        }
+        rc = add_song(import, name, name_len, NULL, 0);
+        free(title);
+        title = NULL;
+    }
+    if (rc == 0 && ferror(in)) {
+        rc = -1;
+    }
+    int saved = errno;
+    free(line);
+    free(title);
+    errno = saved;
+    return rc;
+}
+
+// Field i of a CSV record, unquoted into buf, which has room for the
+// whole record. Returns 0 if the record has fewer fields.
+static int csv_field(const char *rec, size_t len, char delim, int i, char *buf, size_t *field_len) {
+    size_t p = 0;
+    for (int field = 0; ; field++) {
+        size_t n = 0;
+        int quoted = 0;
+        while (p < len && (quoted || rec[p] != delim)) {
+            if (rec[p] == '"') {
+                if (quoted && p + 1 < len && rec[p + 1] == '"') {
+                    if (field == i) {
+                        buf[n++] = '"';
+                    }
+                    p++;
+                } else {
+                    quoted = !quoted;
+                }
+            } else if (field == i) {
+                buf[n++] = rec[p];
+            }
+            p++;
+        }
+        if (field == i) {
+            *field_len = n;
+            return 1;
+        }
+        if (p == len) {
+            return 0;
+        }
+        p++;  // The delimiter
+    }
+}
+
+// The first of ',', ';' and tab outside quotes decides, as spreadsheets
+// write whichever their locale prefers
+static char csv_delimiter(const char *rec, size_t len) {
+    int quoted = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (rec[i] == '"') {
+            quoted = !quoted;
+        } else if (!quoted && (rec[i] == ',' || rec[i] == ';' || rec[i] == '\t')) {
+            return rec[i];
+        }
+    }
+    return ',';
+}
+
+static int is_header(const char *field, size_t len) {
+    static const char *const names[] = { "name", "title", "song", "piece" };
+    char buf[8];
+    size_t n = len < sizeof(buf) ? pif_import_normalize(buf, field, len) : 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (n == strlen(names[i]) && strncasecmp(buf, names[i], n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int read_csv(struct pif_import *import, FILE *in) {
+    char *line = NULL, *rec = NULL, *buf = NULL;
+    size_t size = 0, rec_len = 0, rec_size = 0, buf_size = 0;
+    ssize_t len;
+    char delim = 0;
+    int quotes = 0;
+    int rc = 0;
+    while (rc == 0 && (len = getline(&line, &size, in)) != -1) {
+        chomp(line, &len);
+
+        // A quoted field can run over several lines; the record is whole
+        // once its quotes pair up
+        if (rec_len + (size_t)len + 1 > rec_size) {
+            rec_size = (rec_len + (size_t)len + 1) * 2;
+            char *grown = realloc(rec, rec_size);
+            if (grown == NULL) {
+                rc = -1;
+                break;
+            }
+            rec = grown;
+        }
+        if (quotes % 2 != 0) {
+            rec[rec_len++] = '\n';
+        }
+        memcpy(rec + rec_len, line, (size_t)len);
+        rec_len += (size_t)len;
+        for (ssize_t i = 0; i < len; i++) {
+            quotes += line[i] == '"';
+        }
+        if (quotes % 2 != 0) {
+            continue;
+        }
+
+        const char *text = rec;
+        size_t text_len = rec_len;
+        rec_len = 0;
+        quotes = 0;
+        if (delim == 0 && text_len >= 3 && memcmp(text, "\xef\xbb\xbf", 3) == 0) {
+            text += 3;  // Byte order mark
+            text_len -= 3;
+        }
+        if (text_len == 0) {
+            continue;
+        }
+        if (text_len > buf_size) {
+            free(buf);
+            buf_size = text_len * 2;
+            if ((buf = malloc(buf_size)) == NULL) {
+                rc = -1;
+                break;
+            }
+        }
+
+        size_t name_len, freq_len;
+        int first = delim == 0;
+        if (first) {
+            delim = csv_delimiter(text, text_len);
+        }
+        csv_field(text, text_len, delim, 0, buf, &name_len);
+        if (first && is_header(buf, name_len)) {
+            continue;
+        }
+        // The frequency goes after the name in buf
+        if (!csv_field(text, text_len, delim, 1, buf + name_len, &freq_len)) {
+            freq_len = 0;
+        }
+        // Padding around the frequency is not part of it
+        char *freq = buf + name_len;
+        while (freq_len > 0 && (*freq == ' ' || *freq == '\t')) {
+            freq++;
+            freq_len--;
+        }
+        while (freq_len > 0 && (freq[freq_len - 1] == ' ' || freq[freq_len - 1] == '\t')) {
+            freq_len--;
+        }
+        rc = add_song(import, buf, name_len, freq, freq_len);
+    }
+    if (rc == 0 && ferror(in)) {
+        rc = -1;
+    }
+    int saved = errno;
+    free(line);
+    free(rec);
+    free(buf);
+    errno = saved;
+    return rc;
+}
+
+// A song file found by a directory walk
+struct walk_entry {
+    const char *path;
+    uint32_t stem;  // Offset of the file name in path
+    uint32_t stem_len;
+};
+
+struct walk_worker {
+    struct walk *walk;
+    struct pif_arena text;  // Paths of entries
+    struct walk_entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+// Directories still to read are shared by all workers; each one keeps the
+// songs it finds to itself until the walk is over
+struct walk {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char **pending;  // Directory paths, malloc'd
+    size_t count;
+    size_t capacity;
+    unsigned busy;  // Workers reading a directory, which may add more
+    int err;        // First failure, 0 if none
+    struct pif_import_skip *skipped;  // Paths malloc'd
+    size_t skipped_count;
+    size_t skipped_capacity;
+};
+
+// Call with the lock held
+static int skip_dir(struct walk *walk, char *path, int err) {
+    if (walk->skipped_count == walk->skipped_capacity) {
+        size_t capacity = walk->skipped_capacity ? walk->skipped_capacity * 2 : 16;
+        struct pif_import_skip *skipped = realloc(walk->skipped, capacity * sizeof(*skipped));
+        if (skipped == NULL) {
+            return -1;
+        }
+        walk->skipped = skipped;
+        walk->skipped_capacity = capacity;
+    }
+    walk->skipped[walk->skipped_count++] = (struct pif_import_skip){ path, err };
+    return 0;
+}
+
+// Call with the lock held
+static int queue_dir(struct walk *walk, char *path) {
+    if (walk->count == walk->capacity) {
+        size_t capacity = walk->capacity ? walk->capacity * 2 : 64;
+        char **pending = realloc(walk->pending, capacity * sizeof(*pending));
+        if (pending == NULL) {
+            return -1;
+        }
+        walk->pending = pending;
+        walk->capacity = capacity;
+    }
+    walk->pending[walk->count++] = path;
+    return 0;
+}
+
+static int song_file(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(song_extensions) / sizeof(song_extensions[0]); i++) {
+        if (has_extension(name, len, song_extensions[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int add_entry(struct walk_worker *w, const char *dir, size_t dir_len, const char *name, size_t len) {
+    if (w->count == w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 256;
+        struct walk_entry *entries = realloc(w->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return -1;
+        }
+        w->entries = entries;
+        w->capacity = capacity;
+    }
+    char *path = pif_arena_alloc(&w->text, dir_len + len + 2);
+    if (path == NULL) {
+        return -1;
+    }
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, len + 1);
+
+    const char *dot = memrchr(name, '.', len);
+    w->entries[w->count++] = (struct walk_entry){ path, (uint32_t)(dir_len + 1), (uint32_t)(dot - name) };
+    return 0;
+}
+
+// Read one directory: song files go to the worker, subdirectories to the
+// shared queue. Hidden entries are skipped, and so are links to
+// directories, which could lead the walk in circles.
+static int read_dir(struct walk_worker *w, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+    size_t dir_len = strlen(dir);
+    struct dirent *e;
+    int rc = 0;
+    errno = 0;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') {
+            continue;
+        }
+        size_t len = strlen(e->d_name);
+        int is_dir = e->d_type == DT_DIR;
+        int is_file = e->d_type == DT_REG;
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            struct stat st;
+            if (fstatat(dirfd(d), e->d_name, &st, e->d_type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) == -1) {
+                if (errno == ENOENT) {
+                    errno = 0;  // Dangling link, or gone since readdir
+                    continue;
+                }
+                rc = -1;
+                break;
+            }
+            is_dir = S_ISDIR(st.st_mode) && e->d_type == DT_UNKNOWN;
+            is_file = S_ISREG(st.st_mode);
+        }
+
+        if (is_file && song_file(e->d_name, len)) {
+            rc = add_entry(w, dir, dir_len, e->d_name, len);
+        } else if (is_dir) {
+            char *sub = malloc(dir_len + len + 2);
+            if (sub == NULL || dir_len + len + 1 >= PATH_MAX) {
+                free(sub);
+                errno = sub == NULL ? ENOMEM : ENAMETOOLONG;
+                rc = -1;
+                break;
+            }
+            memcpy(sub, dir, dir_len);
+            sub[dir_len] = '/';
+            memcpy(sub + dir_len + 1, e->d_name, len + 1);
+            pthread_mutex_lock(&w->walk->lock);
+            rc = queue_dir(w->walk, sub);
+            pthread_cond_signal(&w->walk->cond);
+            pthread_mutex_unlock(&w->walk->lock);
+            if (rc == -1) {
+                free(sub);
+            }
+        }
+        if (rc == 0) {
+            errno = 0;
+        }
+    }
+    if (rc == 0 && errno != 0) {
+        rc = -1;  // readdir failed
+    }
+    int saved = errno;
+    closedir(d);
+    errno = saved;
+    return rc;
+}
+
+static void *walk_worker(void *data) {
+    struct walk_worker *w = data;
+    struct walk *walk = w->walk;
+    pthread_mutex_lock(&walk->lock);
+    for (;;) {
+        while (walk->count == 0 && walk->busy > 0 && walk->err == 0) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        if (walk->count == 0 || walk->err != 0) {
+            break;  // Nothing left, and nobody reading who could add more
+        }
+        char *dir = walk->pending[--walk->count];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+
+        int rc = read_dir(w, dir);
+        int err = errno;
+
+        // Only running out of memory ends the walk; a directory that cannot
+        // be read is passed over, keeping whatever was found in it
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (rc == -1 && err != ENOMEM && skip_dir(walk, dir, err) == 0) {
+            dir = NULL;  // Kept for the report
+        } else if (rc == -1 && walk->err == 0) {
+            walk->err = ENOMEM;
+        }
+        free(dir);
+        pthread_cond_broadcast(&walk->cond);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct walk_entry *)a)->path, ((const struct walk_entry *)b)->path);
+}
+
+static int compare_skips(const void *a, const void *b) {
+    return strcmp(((const struct pif_import_skip *)a)->path, ((const struct pif_import_skip *)b)->path);
+}
+
+// Hand the directories a walk passed over to import, in path order
+static int add_skips(struct pif_import *import, struct walk *walk) {
+    if (walk->skipped_count == 0) {
+        return 0;
+    }
+    struct pif_import_skip *skipped =
+        realloc(import->skipped, (import->skipped_count + walk->skipped_count) * sizeof(*skipped));
+    if (skipped == NULL) {
+        return -1;
+    }
+    import->skipped = skipped;
+    qsort(walk->skipped, walk->skipped_count, sizeof(*walk->skipped), compare_skips);
+    for (size_t i = 0; i < walk->skipped_count; i++) {
+        size_t len = strlen(walk->skipped[i].path);
+        char *path = pif_arena_alloc(&import->text, len + 1);
+        if (path == NULL) {
+            return -1;
+        }
+        memcpy(path, walk->skipped[i].path, len + 1);
+        skipped[import->skipped_count++] = (struct pif_import_skip){ path, walk->skipped[i].err };
+    }
+    return 0;
+}
+
+static int read_tree(struct pif_import *import, const char *root, unsigned jobs) {
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (jobs > PIF_IMPORT_MAX_JOBS) {
+        jobs = PIF_IMPORT_MAX_JOBS;
+    }
+
+    // Only directories below the one given are passed over
+    DIR *d = opendir(root);
+    if (d == NULL) {
+        return -1;
+    }
+    closedir(d);
+
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') {
+        root_len--;
+    }
+    struct walk walk = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0, NULL, 0, 0 };
+    struct walk_worker *workers = calloc(jobs, sizeof(*workers));
+    pthread_t *threads = malloc(jobs * sizeof(*threads));
+    char *first = strndup(root, root_len);
+    if (workers == NULL || threads == NULL || first == NULL || queue_dir(&walk, first) == -1) {
+        free(workers);
+        free(threads);
+        free(first);
+        return -1;
+    }
+
+    for (unsigned t = 0; t < jobs; t++) {
+        workers[t].walk = &walk;
+    }
+    unsigned started = 0;
+    while (started < jobs && pthread_create(&threads[started], NULL, walk_worker, &workers[started]) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        walk_worker(&workers[0]);  // No threads to be had, so do it all here
+    }
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Threads finish in any order, so songs are put in path order
+    size_t total = 0;
+    for (unsigned t = 0; t < jobs; t++) {
+        total += workers[t].count;
+    }
+    struct walk_entry *all = walk.err == 0 ? malloc((total ? total : 1) * sizeof(*all)) : NULL;
+    int rc = -1;
+    if (walk.err != 0) {
+        errno = walk.err;
+    } else if (all != NULL) {
+        size_t n = 0;
+        for (unsigned t = 0; t < jobs; t++) {
+            if (workers[t].count > 0) {
+                memcpy(all + n, workers[t].entries, workers[t].count * sizeof(*all));
+                n += workers[t].count;
+            }
+        }
+        qsort(all, total, sizeof(*all), compare_entries);
+        rc = add_skips(import, &walk);
+        for (size_t i = 0; i < total && rc == 0; i++) {
+            rc = add_song(import, all[i].path + all[i].stem, all[i].stem_len, NULL, 0);
+        }
+    }
+
+    int saved = errno;
+    free(all);
+    for (unsigned t = 0; t < jobs; t++) {
+        free(workers[t].entries);
+        pif_arena_free(&workers[t].text);
+    }
+    for (size_t i = 0; i < walk.count; i++) {
+        free(walk.pending[i]);
+    }
+    free(walk.pending);
+    for (size_t i = 0; i < walk.skipped_count; i++) {
+        free((char *)walk.skipped[i].path);
+    }
+    free(walk.skipped);
+    free(workers);
+    free(threads);
+    errno = saved;
+    return rc;
+}
+
+int pif_import_read(struct pif_import *import, const char *path, unsigned jobs) {
+    if (strcmp(path, "-") == 0) {
+        return read_csv(import, stdin);
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return read_tree(import, path, jobs);
+    }
+
+    FILE *in = fopen(path, "re");
+    if (in == NULL) {
+        return -1;
+    }
+    size_t len = strlen(path);
+    int rc = has_extension(path, len, "m3u") || has_extension(path, len, "m3u8") ? read_m3u(import, in)
+                                                                                 : read_csv(import, in);
+    int saved = errno;
+    fclose(in);
+    errno = saved;
+    return rc;
+}
+
+void pif_import_free(struct pif_import *import) {
+    pif_arena_free(&import->text);
+    free(import->lines);
+    free(import->lens);
+    free(import->skipped);
+    import->lines = NULL;
+    import->lens = NULL;
+    import->count = 0;
+    import->capacity = 0;
+    import->skipped = NULL;
+    import->skipped_count = 0;
+}
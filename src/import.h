@@ -0,0 +1,78 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Bulk import of a repertoire into "name freq" lines, ready for
+// pif_library_add. Sources are:
+//
+//   - a directory: walked on a pool of threads, one song per score or
+//     recording file, named after the file without its extension
+//   - an .m3u or .m3u8 playlist: one song per entry, named by its
+//     #EXTINF title or else after the file
+//   - anything else, "-" for stdin: CSV with the name in the first
+//     column and an optional frequency in the second; a plain list of
+//     names is a one-column CSV
+//
+// Files are streamed a line at a time. Names are normalized to the form
+// pif stores: runs of whitespace become one '_' and the ends are trimmed,
+// so a name never contains the space that separates it from its
+// frequency. Duplicates are left to pif_library_add.
+//
+// A directory below the one given that cannot be read, say for lack of
+// permission, does not stop the walk; it is listed in skipped instead.
+
+// A directory the walk could not read, and why
+struct pif_import_skip {
+    const char *path;
+    int err;
+};
+
+struct pif_import {
+    struct pif_arena text;  // Every line, and skipped paths
+    const char **lines;
+    uint32_t *lens;
+    size_t count;
+    size_t capacity;
+    const char *freq;  // For songs their source gives no frequency; NULL for none
+    struct pif_import_skip *skipped;  // In path order for each walk
+    size_t skipped_count;
+};
+
+#define PIF_IMPORT_INIT { PIF_ARENA_INIT, NULL, NULL, 0, 0, NULL, NULL, 0 }
+
+// Directory walks use jobs threads, 0 for one per CPU
+#define PIF_IMPORT_MAX_JOBS 64
+
+// Add the songs of one source, in the order the source lists them; a
+// directory's songs are ordered by path. Returns 0 or -1 with errno set,
+// in which case the songs read before the failure are kept.
+int pif_import_read(struct pif_import *import, const char *path, unsigned jobs);
+
+// Normalize len bytes of name into out, which must have room for len
+// bytes. Returns the normalized length, 0 if nothing is left.
+size_t pif_import_normalize(char *out, const char *name, size_t len);
+
+void pif_import_free(struct pif_import *import);
+
+#endif
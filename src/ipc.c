@@ -0,0 +1,175 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "ipc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+
+int pif_ipc_socket_path(char *buf, size_t size) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] == '\0') {
+        errno = ENOENT;
+        return -1;
+    }
+    int len = snprintf(buf, size, "%s/" PIF_IPC_SOCKET_NAME, dir);
+    if (len < 0 || (size_t)len >= size || (size_t)len >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int pif_ipc_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int copy_out(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Parse the status line; returns -1 if it is malformed
+static int parse_status(const char *line, int *status, char *err, size_t err_size) {
+    if (strcmp(line, "ok") == 0) {
+        *status = 0;
+        if (err_size > 0) {
+            err[0] = '\0';
+        }
+        return 0;
+    }
+    int code, msg;
+    if (sscanf(line, "error %d %n", &code, &msg) != 1 || code <= 0) {
+        return -1;
+    }
+    *status = code;
+    snprintf(err, err_size, "%s", line + msg);
+    return 0;
+}
+
+int pif_ipc_call(int fd, const char *request, int out_fd, int *status, char *err, size_t err_size) {
+    size_t len = strlen(request);
+    int rc = -1;
+    if (len + 1 > PIF_IPC_MAX_REQUEST || memchr(request, '\n', len) != NULL) {
+        errno = EINVAL;
+        goto out;
+    }
+    if (write_all(fd, request, len) == -1 || write_all(fd, "\n", 1) == -1 || shutdown(fd, SHUT_WR) == -1) {
+        goto out;
+    }
+
+    char buf[8192];
+    size_t used = 0;
+    int have_status = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + used, sizeof(buf) - used);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto out;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t)n;
+
+        if (!have_status) {
+            char *eol = memchr(buf, '\n', used);
+            if (eol == NULL) {
+                if (used == sizeof(buf)) {
+                    errno = EPROTO;
+                    goto out;
+                }
+                continue;
+            }
+            *eol = '\0';
+            if (parse_status(buf, status, err, err_size) == -1) {
+                errno = EPROTO;
+                goto out;
+            }
+            have_status = 1;
+            size_t rest = used - (size_t)(eol + 1 - buf);
+            memmove(buf, eol + 1, rest);
+            used = rest;
+        }
+        if (copy_out(out_fd, buf, used) == -1) {
+            goto out;
+        }
+        used = 0;
+    }
+    if (!have_status) {
+        errno = EPROTO;  // The daemon went away before answering
+        goto out;
+    }
+    rc = 0;
+
+out:;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
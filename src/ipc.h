@@ -0,0 +1,55 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef IPC_H
+#define IPC_H
+
+#include <stddef.h>
+
+// Wire protocol between pif and pifd. A client connects to the socket,
+// sends one request line and reads the reply until the daemon closes the
+// connection. The reply starts with a status line, "ok" or
+// "error <errno> <message>", and the body is what pif would print.
+//
+//   today             rotation and due songs, advancing the rotation
+//   rotation          the songs the next "today" would pick
+//   due               due frequency songs
+//   next-due          when the next frequency song falls due
+//   plan <days>       the rotation and due songs of the coming days
+//   practiced <song>  record a practice session now
+//   add <line>        append a "name freq" line to ~/.pif
+//   remove <row>      remove the song on line row (1-based)
+//   forget <song>     remove the song called song
+//   freq <song> <f>   set a song's frequency to f days or rot
+#define PIF_IPC_SOCKET_NAME "pif.sock"
+#define PIF_IPC_MAX_REQUEST 4096
+#define PIF_PLAN_MAX_DAYS 36600  // A hundred years ought to do
+
+// Path of the socket in $XDG_RUNTIME_DIR. Returns 0 on success or -1 with
+// errno set; ENOENT if XDG_RUNTIME_DIR is not set.
+int pif_ipc_socket_path(char *buf, size_t size);
+
+// Connect to the daemon listening on path. Returns the socket or -1 with
+// errno set; ENOENT or ECONNREFUSED mean no daemon is running.
+int pif_ipc_connect(const char *path);
+
+// Send request (without its newline) on fd and copy the reply body to
+// out_fd. *status is 0 or the errno the daemon reported, with its message
+// in err. Closes fd. Returns 0 once a reply was read or -1 with errno set.
+int pif_ipc_call(int fd, const char *request, int out_fd, int *status, char *err, size_t err_size);
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "journal.h"
+#include "edit.h"
+#include "libpif.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define JOURNAL_MAGIC "# pif-journal"
+
+static int journal_path(char *buf, size_t size, const char *fileloc) {
+    int len = snprintf(buf, size, "%s" PIF_JOURNAL_SUFFIX, fileloc);
+    if (len < 0 || (size_t)len >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int pif_journal_lock(const char *fileloc) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s" PIF_LOCK_SUFFIX, fileloc);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+void pif_journal_unlock(int lock) {
+    close(lock);  // Releases the flock
+}
+
+static int format_header(char *buf, size_t size, const struct stat *base) {
+    return snprintf(buf, size, JOURNAL_MAGIC " %lld %lld\n",
+                    (long long)base->st_size, (long long)mtime_ns(base));
+}
+
+// Whether the journal open on fd was written against base; an empty one is
+// fine. Returns 1, 0 or -1 with errno set.
+static int journal_matches(int fd, const struct stat *base) {
+    char header[128];
+    ssize_t got = pread(fd, header, sizeof(header) - 1, 0);
+    if (got <= 0) {
+        return got == 0 ? 1 : -1;
+    }
+    header[got] = '\0';
+    char *eol = strchr(header, '\n');
+    if (eol == NULL) {
+        return 0;
+    }
+    *eol = '\0';
+    long long base_size, base_mtime;
+    return sscanf(header, JOURNAL_MAGIC " %lld %lld", &base_size, &base_mtime) == 2 &&
+           base_size == (long long)base->st_size && base_mtime == mtime_ns(base);
+}
+
+// Move the records of a journal that no longer matches ~/.pif, because it
+// was changed behind pif's back, to ~/.pif.journal.stale so they are not
+// lost. Returns how many records there were or -1 with errno set.
+static int set_aside(int fd, const char *fileloc, off_t size) {
+    char *buf = malloc(size > 0 ? (size_t)size : 1);
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t len = 0;
+    while (len < (size_t)size) {
+        ssize_t n = pread(fd, buf + len, (size_t)size - len, (off_t)len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+
+    int records = 0;
+    const char *p = memchr(buf, '\n', len);  // Past the header
+    while (p != NULL && (p = memchr(p + 1, '\n', buf + len - p - 1)) != NULL && records < INT_MAX) {
+        records++;
+    }
+
+    char stale[PATH_MAX];
+    int rc = -1;
+    int path_len = snprintf(stale, sizeof(stale), "%s" PIF_JOURNAL_STALE_SUFFIX, fileloc);
+    if (path_len < 0 || (size_t)path_len >= sizeof(stale)) {
+        errno = ENAMETOOLONG;
+    } else if (records == 0) {
+        rc = 0;
+    } else {
+        int out = open(stale, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (out != -1) {
+            rc = write_all(out, buf, len) == 0 && fsync(out) == 0 ? records : -1;
+            int saved = errno;
+            close(out);
+            errno = saved;
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+static int append_all(const char *fileloc, const struct pif_journal_record *records, size_t count,
+                      off_t *size) {
+    size_t max = 128;
+    for (size_t i = 0; i < count; i++) {
+        if (memchr(records[i].line, '\n', records[i].len) != NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        max += records[i].len + 16;
+    }
+
+    char path[PATH_MAX];
+    if (journal_path(path, sizeof(path), fileloc) == -1) {
+        return -1;
+    }
+
+    // Header (for a new journal) and records go out in a single write
+    char *buf = malloc(max);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    int lock = pif_journal_lock(fileloc);
+    if (lock == -1) {
+        free(buf);
+        return -1;
+    }
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        int saved = errno;
+        pif_journal_unlock(lock);
+        free(buf);
+        errno = saved;
+        return -1;
+    }
+
+    int rc = -1;
+    int stale = 0;
+    size_t n = 0;
+    struct stat st, base;
+    pif_trace_stats(2);
+    if (fstat(fd, &st) == -1 || stat(fileloc, &base) == -1) {
+        goto out;
+    }
+    // Records written against an older ~/.pif would never be replayed, nor
+    // would anything appended after them
+    if (st.st_size > 0) {
+        int matches = journal_matches(fd, &base);
+        if (matches == -1) {
+            goto out;
+        }
+        if (matches == 0) {
+            stale = set_aside(fd, fileloc, st.st_size);
+            if (stale == -1 || ftruncate(fd, 0) == -1) {
+                goto out;
+            }
+            st.st_size = 0;
+        }
+    }
+    if (st.st_size == 0) {
+        n += (size_t)format_header(buf, max, &base);
+    }
+    for (size_t i = 0; i < count; i++) {
+        const struct pif_journal_record *r = &records[i];
+        if (r->op == PIF_JOURNAL_ADD) {
+            n += (size_t)snprintf(buf + n, max - n, "%c %.*s\n", r->op, (int)r->len, r->line);
+        } else {
+            n += (size_t)snprintf(buf + n, max - n, "%c %u %.*s\n", r->op, r->row, (int)r->len, r->line);
+        }
+    }
+
+    if (write_all(fd, buf, n) == 0 && fsync(fd) == 0) {
+        rc = stale;
+        if (size != NULL) {
+            *size = st.st_size + (off_t)n;
+        }
+    } else {
+        // Drop a partial batch so a retry does not repeat its records
+        int saved = errno;
+        if (ftruncate(fd, st.st_size) == 0) {
+            errno = saved;
+        }
+    }
+
+out:;
+    int saved = errno;
+    close(fd);
+    pif_journal_unlock(lock);
+    free(buf);
+    errno = saved;
+    return rc;
+}
+
+int pif_journal_append_all(const char *fileloc, const struct pif_journal_record *records, size_t count,
+                           off_t *size) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = append_all(fileloc, records, count, size);
+    pif_trace_end(&span, PIF_PHASE_SAVE);
+    return rc;
+}
+
+int pif_journal_append(const char *fileloc, char op, uint32_t row, const char *line, size_t len, off_t *size) {
+    struct pif_journal_record record = { op, row, line, len };
+    return pif_journal_append_all(fileloc, &record, 1, size);
+}
+
+static int same_name(const struct pif_song *song, const char *line, size_t len) {
+    uint32_t name_len;
+    int32_t freq;
+    pif_parse_line(line, len, &name_len, &freq);
+    return song->name_len == name_len && memcmp(song->line, line, name_len) == 0;
+}
+
+static int same_line(const struct pif_song *song, const char *line, size_t len) {
+    return song->line_len == len && memcmp(song->line, line, len) == 0;
+}
+
+static int apply(struct pif_library *lib, char op, uint32_t row, const char *line, size_t len) {
+    switch (op) {
+    case PIF_JOURNAL_ADD:
+        return pif_library_append(lib, line, len);
+    case PIF_JOURNAL_REMOVE:
+        // Rows normally match; fall back to the first identical line
+        if (row >= lib->count || !same_line(&lib->songs[row], line, len)) {
+            for (row = 0; row < lib->count && !same_line(&lib->songs[row], line, len); row++) {
+            }
+        }
+        return row < lib->count ? pif_library_remove(lib, row) : 0;
+    case PIF_JOURNAL_REPLACE:
+        if (row >= lib->count || !same_name(&lib->songs[row], line, len)) {
+            for (row = 0; row < lib->count && !same_name(&lib->songs[row], line, len); row++) {
+            }
+        }
+        return row < lib->count ? pif_library_replace(lib, row, line, len) : 0;
+    default:
+        return 0;
+    }
+}
+
+int pif_journal_replay(struct pif_library *lib, const char *fileloc) {
+    lib->journal_applied = 0;
+
+    char path[PATH_MAX];
+    if (journal_path(path, sizeof(path), fileloc) == -1) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct stat st;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    lib->journal_dev = (uint64_t)st.st_dev;
+    lib->journal_ino = (uint64_t)st.st_ino;
+
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // Only replay a journal written against the ~/.pif we loaded
+    const char *end = map + size;
+    const char *eol = memchr(map, '\n', size);
+    long long base_size, base_mtime;
+    char header[128];
+    size_t header_len = eol != NULL ? (size_t)(eol - map) : 0;
+    if (header_len == 0 || header_len >= sizeof(header)) {
+        munmap((void *)map, size);
+        return 0;
+    }
+    memcpy(header, map, header_len);
+    header[header_len] = '\0';
+    if (sscanf(header, JOURNAL_MAGIC " %lld %lld", &base_size, &base_mtime) != 2 ||
+        (uint64_t)base_size != lib->db.hdr->source_size || base_mtime != lib->db.hdr->source_mtime_ns) {
+        munmap((void *)map, size);
+        return 0;
+    }
+
+    int rc = 0;
+    const char *p = eol + 1;
+    while (p < end && rc == 0) {
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            break;  // Ignore a record that is still being appended
+        }
+
+        char op = *p;
+        const char *q = p + 2;
+        uint32_t row = 0;
+        if (eol - p >= 2 && p[1] == ' ') {
+            if (op != PIF_JOURNAL_ADD) {
+                while (q < eol && *q >= '0' && *q <= '9') {
+                    row = row * 10 + (uint32_t)(*q++ - '0');
+                }
+                q++;  // Space after the row
+            }
+            if (q <= eol) {
+                rc = apply(lib, op, row, q, eol - q);
+            }
+        }
+        p = eol + 1;
+    }
+
+    lib->journal_applied = (size_t)(p - map);
+    munmap((void *)map, size);
+    return rc;
+}
+
+// Write every line of lib to a new temp file next to path
+static int write_library(const struct pif_library *lib, const char *path, char *temp_path, size_t temp_size,
+                         struct stat *st) {
+    int len = snprintf(temp_path, temp_size, "%s.XXXXXX", path);
+    if (len < 0 || (size_t)len >= temp_size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        return -1;
+    }
+
+    char buf[64 * 1024];
+    size_t n = 0;
+    int rc = 0;
+    for (uint32_t i = 0; i < lib->count && rc == 0; i++) {
+        const struct pif_song *song = &lib->songs[i];
+        if (n + song->line_len + 1 > sizeof(buf)) {
+            rc = write_all(fd, buf, n);
+            n = 0;
+        }
+        if (song->line_len + 1 > sizeof(buf)) {
+            rc = rc == 0 ? write_all(fd, song->line, song->line_len) : rc;
+            rc = rc == 0 ? write_all(fd, "\n", 1) : rc;
+            continue;
+        }
+        memcpy(buf + n, song->line, song->line_len);
+        n += song->line_len;
+        buf[n++] = '\n';
+    }
+    if (rc == 0) {
+        rc = write_all(fd, buf, n);
+    }
+    pif_trace_stats(1);
+    if (rc == 0 && (fchmod(fd, 0600) == -1 || fsync(fd) == -1 || fstat(fd, st) == -1)) {
+        rc = -1;
+    }
+
+    int saved = errno;
+    if (close(fd) == -1 && rc == 0) {
+        saved = errno;
+        rc = -1;
+    }
+    if (rc == -1) {
+        unlink(temp_path);
+    }
+    errno = saved;
+    return rc;
+}
+
+int pif_journal_compact_locked(const char *fileloc, const char *practice_dir) {
+    char path[PATH_MAX];
+    // Opening the library would otherwise wait for the lock we hold
+    if (journal_path(path, sizeof(path), fileloc) == -1 || pif_edit_recover_locked(fileloc) == -1) {
+        return -1;
+    }
+
+    // A journal for an older ~/.pif has nothing to fold in; keep its records
+    // aside rather than leave it to swallow every later append
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno != ENOENT) {
+        return -1;
+    }
+    if (fd != -1) {
+        struct stat st, base;
+        int stale = 0;
+        pif_trace_stats(2);
+        if (fstat(fd, &st) == -1 || stat(fileloc, &base) == -1) {
+            stale = -1;
+        } else if (st.st_size > 0) {
+            int matches = journal_matches(fd, &base);
+            if (matches == -1) {
+                stale = -1;
+            } else if (matches == 0) {
+                stale = set_aside(fd, fileloc, st.st_size);
+                if (stale != -1 && unlink(path) == -1) {
+                    stale = -1;
+                }
+            }
+        }
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        if (stale != 0) {
+            return stale;
+        }
+    }
+
+    struct pif_library lib;
+    if (pif_library_open(&lib, fileloc, practice_dir) == -1) {
+        return -1;
+    }
+    if (lib.journal_applied == 0) {
+        pif_library_close(&lib);
+        return 0;
+    }
+
+    char pif_temp[PATH_MAX];
+    struct stat new_st;
+    if (write_library(&lib, fileloc, pif_temp, sizeof(pif_temp), &new_st) == -1) {
+        int saved = errno;
+        pif_library_close(&lib);
+        errno = saved;
+        return -1;
+    }
+    uint64_t dev = lib.journal_dev, ino = lib.journal_ino;
+    pif_library_close(&lib);
+
+    // The lock should make this impossible, but dropping a journal other
+    // than the one just folded in would lose its edits
+    struct stat st;
+    pif_trace_stats(1);
+    if (stat(path, &st) == -1 || (uint64_t)st.st_dev != dev || (uint64_t)st.st_ino != ino) {
+        int saved = errno == ENOENT || errno == 0 ? ESTALE : errno;
+        unlink(pif_temp);
+        errno = saved;
+        return -1;
+    }
+
+    // Crashing between these two steps leaves a journal that no longer
+    // matches the new ~/.pif, whose records are all in it already; the next
+    // append or compaction sets it aside
+    if (rename(pif_temp, fileloc) == -1) {
+        int saved = errno;
+        unlink(pif_temp);
+        errno = saved;
+        return -1;
+    }
+    return unlink(path);
+}
+
+static int compact(const char *fileloc, const char *practice_dir) {
+    int lock = pif_journal_lock(fileloc);
+    if (lock == -1) {
+        return -1;
+    }
+    int rc = pif_journal_compact_locked(fileloc, practice_dir);
+    int saved = errno;
+    pif_journal_unlock(lock);
+    errno = saved;
+    return rc;
+}
+
+int pif_journal_compact(const char *fileloc, const char *practice_dir) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = compact(fileloc, practice_dir);
+    pif_trace_end(&span, PIF_PHASE_SAVE);
+    return rc;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct pif_library;
+
+// Edits to ~/.pif are appended to ~/.pif.journal instead of rewriting the
+// whole file. The journal starts with a header naming the size and mtime
+// of the ~/.pif it applies to, followed by one record per edit:
+//
+//   + <line>          append a song
+//   - <row> <line>    remove the song at row
+//   = <row> <line>    replace the song at row
+//
+// Every reader of ~/.pif replays it through pif_library_open, and
+// pif_journal_compact folds it back into ~/.pif once it grows. A journal
+// for a ~/.pif that has since been changed by hand can no longer be
+// replayed; the next append or compaction moves its records to
+// ~/.pif.journal.stale and starts over.
+//
+// Whoever changes ~/.pif or its journal holds an exclusive flock on
+// ~/.pif.lock, which is never replaced, so compaction cannot lose records
+// appended while it runs.
+#define PIF_JOURNAL_SUFFIX ".journal"
+#define PIF_JOURNAL_STALE_SUFFIX PIF_JOURNAL_SUFFIX ".stale"
+#define PIF_LOCK_SUFFIX ".lock"
+#define PIF_JOURNAL_COMPACT_SIZE (64 * 1024)
+
+#define PIF_JOURNAL_ADD '+'
+#define PIF_JOURNAL_REMOVE '-'
+#define PIF_JOURNAL_REPLACE '='
+
+struct pif_journal_record {
+    char op;
+    uint32_t row;  // Ignored for PIF_JOURNAL_ADD
+    const char *line;
+    size_t len;
+};
+
+// Append edits to the journal for fileloc in one write and one fsync.
+// Either all of them are on disk afterwards or, on failure, none are, so
+// the same batch can be tried again. If size is not NULL it gets the
+// journal's size afterwards. Returns the number of stale records set
+// aside, normally 0, or -1 with errno set.
+int pif_journal_append_all(const char *fileloc, const struct pif_journal_record *records, size_t count,
+                           off_t *size);
+int pif_journal_append(const char *fileloc, char op, uint32_t row, const char *line, size_t len, off_t *size);
+
+// Apply the journal for fileloc to a freshly opened library. A journal
+// that belongs to a different version of fileloc is ignored.
+int pif_journal_replay(struct pif_library *lib, const char *fileloc);
+
+// Rewrite fileloc with the journal applied and drop the journal. Appends
+// wait until it is done. Returns the number of stale records set aside
+// instead, normally 0, or -1 with errno set.
+int pif_journal_compact(const char *fileloc, const char *practice_dir);
+
+// The same, for a caller that holds pif_journal_lock already
+int pif_journal_compact_locked(const char *fileloc, const char *practice_dir);
+
+// Take the lock on edits to fileloc, waiting for whoever holds it.
+// Returns a descriptor for pif_journal_unlock or -1 with errno set.
+int pif_journal_lock(const char *fileloc);
+void pif_journal_unlock(int lock);
+
+#endif
@@ -0,0 +1,848 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "libpif.h"
+#include "journal.h"
+#include "edit.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+
+int pif_config_load(struct pif_config *config, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char line[256];
+    if (fgets(line, sizeof(line), file)) {
+        sscanf(line, "songs_per_day=%d\n", &config->songs_per_day);
+    }
+    if (fgets(line, sizeof(line), file)) {
+        sscanf(line, "last_played=%d\n", &config->last_played);
+    }
+    fclose(file);
+    return 0;
+}
+
+int32_t pif_parse_freq(const char *f, size_t len) {
+    if (len == 3 && memcmp(f, "rot", 3) == 0) {
+        return PIF_FREQ_ROT;
+    }
+    if (len == 0 || len > 9) {
+        return PIF_FREQ_NONE;
+    }
+    int32_t days = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (f[i] < '0' || f[i] > '9') {
+            return PIF_FREQ_NONE;
+        }
+        days = days * 10 + (f[i] - '0');
+    }
+    return days;
+}
+
+void pif_parse_line(const char *line, size_t len, uint32_t *name_len, int32_t *freq) {
+    const char *space = memrchr(line, ' ', len);
+    if (space == NULL) {
+        *name_len = (uint32_t)len;
+        *freq = PIF_FREQ_NONE;
+        return;
+    }
+    *name_len = (uint32_t)(space - line);
+    *freq = pif_parse_freq(space + 1, line + len - space - 1);
+}
+
+// Memory kept until the library is closed comes from its run arena, if
+// it has one, and is then never freed on its own
+static void *lib_alloc(const struct pif_library *lib, size_t size) {
+    return lib->run != NULL ? pif_arena_alloc(lib->run, size) : malloc(size);
+}
+
+static void *lib_calloc(const struct pif_library *lib, size_t n, size_t size) {
+    return lib->run != NULL ? pif_arena_calloc(lib->run, n, size) : calloc(n, size);
+}
+
+static void lib_free(const struct pif_library *lib, void *p) {
+    if (lib->run == NULL) {
+        free(p);
+    }
+}
+
+// Grow *array, of which used elements are kept, to hold at least want
+static int grow_array(const struct pif_library *lib, void **array, uint32_t *capacity, uint32_t used,
+                      uint32_t want, size_t size) {
+    if (want <= *capacity) {
+        return 0;
+    }
+    uint32_t bigger = *capacity ? *capacity : 64;
+    while (bigger < want) {
+        bigger *= 2;
+    }
+    void *p;
+    if (lib->run != NULL) {
+        // Doubling keeps the abandoned copies below the size of the last one
+        p = pif_arena_alloc(lib->run, bigger * size);
+        if (p != NULL && used > 0) {
+            memcpy(p, *array, used * size);
+        }
+    } else {
+        p = realloc(*array, bigger * size);
+    }
+    if (p == NULL) {
+        return -1;
+    }
+    *array = p;
+    *capacity = bigger;
+    return 0;
+}
+
+static int reserve(struct pif_library *lib, uint32_t count) {
+    return grow_array(lib, (void **)&lib->songs, &lib->capacity, lib->count, count, sizeof(*lib->songs));
+}
+
+static int reserve_ids(struct pif_library *lib, uint32_t count) {
+    return grow_array(lib, (void **)&lib->row_of, &lib->id_capacity, lib->next_id, count, sizeof(*lib->row_of));
+}
+
+// Point the song records at the snapshot. Returns 1 if an entry lies
+// outside its string table.
+static int load_snapshot(struct pif_library *lib) {
+    // Records point straight at the snapshot's string table
+    const struct pifdb *db = &lib->db;
+    if (reserve(lib, db->count) == -1 || reserve_ids(lib, db->count) == -1) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < db->count; i++) {
+        struct pif_song *song = &lib->songs[i];
+        song->line = pifdb_line(db, i);
+        if (song->line == NULL) {
+            return 1;
+        }
+        song->line_len = db->line_len[i];
+        song->name_len = db->name_len[i];
+        song->freq = db->rot[i] ? PIF_FREQ_ROT : db->freq[i];
+        song->snapshot = i + 1;
+        song->id = i;
+        song->last_practice = db->last_practice[i];
+        lib->row_of[i] = i;
+    }
+    lib->count = db->count;
+    lib->next_id = db->count;
+    return 0;
+}
+
+static int open_library(struct pif_library *lib, const char *fileloc, const char *practice_dir,
+                        struct pif_arena *run) {
+    memset(lib, 0, sizeof(*lib));
+    lib->run = run;
+    lib->schedule.arena = run;
+    practice_source_init(&lib->practice, practice_dir);
+    lib->practice.arena = run;
+
+    // Finish an in-place edit cut short by a crash before reading
+    if (pif_edit_recover(fileloc) == -1 || pifdb_open(&lib->db, fileloc, &lib->practice) == -1) {
+        int saved = errno;
+        practice_source_close(&lib->practice);
+        errno = saved;
+        return -1;
+    }
+
+    int damaged = load_snapshot(lib);
+    if (damaged == 1) {
+        // An entry slipped past the checksum; start over from the text file
+        pifdb_close(&lib->db);
+        damaged = pifdb_rebuild(&lib->db, fileloc, &lib->practice) == -1 ? -1 : load_snapshot(lib);
+        if (damaged == 1) {
+            errno = EIO;
+        }
+    }
+    if (damaged != 0) {
+        int saved = errno;
+        pif_library_close(lib);
+        errno = saved;
+        return -1;
+    }
+
+    // The snapshot already lists the rotation songs in order
+    lib->rotation = (uint32_t *)lib->db.rot_index;
+    lib->rot_count = lib->db.rot_count;
+
+    // Edits made since ~/.pif was last written
+    if (pif_journal_replay(lib, fileloc) == -1) {
+        int saved = errno;
+        pif_library_close(lib);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+int pif_library_open_run(struct pif_library *lib, const char *fileloc, const char *practice_dir,
+                         struct pif_arena *run) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = open_library(lib, fileloc, practice_dir, run);
+    pif_trace_end(&span, PIF_PHASE_PARSE);
+    return rc;
+}
+
+int pif_library_open(struct pif_library *lib, const char *fileloc, const char *practice_dir) {
+    return pif_library_open_run(lib, fileloc, practice_dir, NULL);
+}
+
+void pif_library_close(struct pif_library *lib) {
+    if (lib->rotation != lib->db.rot_index) {
+        lib_free(lib, lib->rotation);
+    }
+    pif_arena_free(&lib->text);
+    lib_free(lib, lib->songs);
+    lib_free(lib, lib->row_of);
+    trigram_free(&lib->names);
+    name_index_free(&lib->by_name);
+    due_heap_free(&lib->schedule);
+    pifdb_close(&lib->db);
+    practice_source_close(&lib->practice);
+    memset(lib, 0, sizeof(*lib));
+}
+
+static int index_names(struct pif_library *lib) {
+    trigram_free(&lib->names);
+    for (uint32_t i = 0; i < lib->count; i++) {
+        if (trigram_add(&lib->names, lib->songs[i].id, lib->songs[i].line, lib->songs[i].name_len) == -1) {
+            trigram_free(&lib->names);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Ids of removed songs are not reused, so once they outnumber the songs
+// left, number the songs afresh from 0. Doing so takes a pass over the
+// library and the indexes keyed by id, but so many removals do as well.
+static void renumber(struct pif_library *lib) {
+    for (uint32_t k = 0; k < lib->count; k++) {
+        lib->songs[k].id = k;
+        lib->row_of[k] = k;
+    }
+    lib->next_id = lib->count;
+    if (lib->names.capacity != 0) {
+        index_names(lib);  // Searches scan every song if this fails
+    }
+    if (lib->by_name.capacity != 0 && name_index_build(&lib->by_name, lib->songs, lib->count) == -1) {
+        name_index_free(&lib->by_name);  // Rebuilt on the next lookup
+    }
+    lib->schedule_valid = 0;
+}
+
+// Bring a built schedule in line with song's frequency and cached time,
+// given whether it was scheduled before. If that fails the schedule is
+// rebuilt on the next due query instead.
+static void reschedule(struct pif_library *lib, const struct pif_song *song, int scheduled) {
+    if (!lib->schedule_valid) {
+        return;
+    }
+    if (song->freq <= 0) {
+        due_heap_remove(&lib->schedule, song->id);
+    } else if (scheduled) {
+        due_heap_update(&lib->schedule, song->id, pif_song_due_time(song));
+    } else if (due_heap_insert(&lib->schedule, song->id, pif_song_due_time(song)) == -1) {
+        lib->schedule_valid = 0;
+    }
+}
+
+int pif_library_append(struct pif_library *lib, const char *line, size_t len) {
+    if (reserve(lib, lib->count + 1) == -1 || reserve_ids(lib, lib->next_id + 1) == -1) {
+        return -1;
+    }
+    char *copy = pif_arena_strndup(lib->run != NULL ? lib->run : &lib->text, line, len);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    // An id is never handed out twice, even if adding the song fails
+    struct pif_song *song = &lib->songs[lib->count];
+    memset(song, 0, sizeof(*song));
+    song->line = copy;
+    song->line_len = (uint32_t)len;
+    song->id = lib->next_id++;
+    lib->row_of[song->id] = UINT32_MAX;
+    pif_parse_line(copy, len, &song->name_len, &song->freq);
+    if (lib->names.capacity != 0 && trigram_add(&lib->names, song->id, copy, song->name_len) == -1) {
+        return -1;
+    }
+    if (lib->by_name.capacity != 0 && name_index_add(&lib->by_name, lib->songs, lib->count) == -1) {
+        trigram_remove(&lib->names, song->id, copy, song->name_len);
+        return -1;
+    }
+    lib->row_of[song->id] = lib->count;
+    lib->count++;
+    lib->rotation_dirty = 1;
+    reschedule(lib, song, 0);
+    return 0;
+}
+
+int pif_library_remove(struct pif_library *lib, uint32_t i) {
+    if (i >= lib->count) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t id = lib->songs[i].id;
+    trigram_remove(&lib->names, id, lib->songs[i].line, lib->songs[i].name_len);
+    name_index_remove(&lib->by_name, lib->songs, i);
+    if (lib->schedule_valid) {
+        due_heap_remove(&lib->schedule, id);
+    }
+    memmove(&lib->songs[i], &lib->songs[i + 1], (lib->count - i - 1) * sizeof(*lib->songs));
+    lib->count--;
+    lib->row_of[id] = UINT32_MAX;
+    for (uint32_t k = i; k < lib->count; k++) {
+        lib->row_of[lib->songs[k].id] = k;
+    }
+    if (lib->next_id - lib->count > lib->count + 4096) {
+        renumber(lib);
+    }
+    lib->rotation_dirty = 1;
+    return 0;
+}
+
+int pif_library_replace(struct pif_library *lib, uint32_t i, const char *line, size_t len) {
+    if (i >= lib->count) {
+        errno = EINVAL;
+        return -1;
+    }
+    char *copy = pif_arena_strndup(lib->run != NULL ? lib->run : &lib->text, line, len);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    struct pif_song *song = &lib->songs[i];
+    int scheduled = song->freq > 0;
+    uint32_t name_len;
+    int32_t freq;
+    pif_parse_line(copy, len, &name_len, &freq);
+
+    // A renamed song no longer shares its practice history
+    int renamed = name_len != song->name_len || memcmp(copy, song->line, name_len) != 0;
+    if (renamed) {
+        trigram_remove(&lib->names, song->id, song->line, song->name_len);
+        if (lib->names.capacity != 0 && trigram_add(&lib->names, song->id, copy, name_len) == -1) {
+            return -1;
+        }
+        name_index_remove(&lib->by_name, lib->songs, i);
+        song->snapshot = 0;
+        song->last_practice = 0;
+    }
+    song->line = copy;
+    song->line_len = (uint32_t)len;
+    song->name_len = name_len;
+    song->freq = freq;
+    if (renamed && lib->by_name.capacity != 0 && name_index_add(&lib->by_name, lib->songs, i) == -1) {
+        name_index_free(&lib->by_name);  // Rebuilt on the next lookup
+    }
+    lib->rotation_dirty = 1;
+    reschedule(lib, song, scheduled);
+    return 0;
+}
+
+int pif_library_index(struct pif_library *lib) {
+    if (index_names(lib) == -1) {
+        return -1;
+    }
+    if (name_index_build(&lib->by_name, lib->songs, lib->count) == -1) {
+        trigram_free(&lib->names);
+        return -1;
+    }
+    return 0;
+}
+
+int pif_library_find(struct pif_library *lib, const char *name, size_t len, uint32_t *row) {
+    if (lib->by_name.capacity == 0 && name_index_build(&lib->by_name, lib->songs, lib->count) == -1) {
+        return -1;
+    }
+    uint32_t found = name_index_find(&lib->by_name, lib->songs, lib->row_of, name, len);
+    if (found == UINT32_MAX) {
+        return 0;
+    }
+    *row = found;
+    return 1;
+}
+
+int pif_library_add(struct pif_library *lib, const char *line, size_t len) {
+    uint32_t name_len;
+    int32_t freq;
+    uint32_t row;
+    pif_parse_line(line, len, &name_len, &freq);
+    int found = pif_library_find(lib, line, name_len, &row);
+    if (found != 0) {
+        if (found == 1) {
+            errno = EEXIST;
+        }
+        return -1;
+    }
+    return pif_library_append(lib, line, len);
+}
+
+static unsigned char fold(char c) {
+    return (unsigned char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+int pif_song_matches(const struct pif_song *song, const char *query, size_t len) {
+    if (len == 0) {
+        return 1;
+    }
+    if (len > song->name_len) {
+        return 0;
+    }
+    unsigned char first = fold(query[0]);
+    const char *last = song->line + song->name_len - len;
+    for (const char *p = song->line; p <= last; p++) {
+        if (fold(*p) != first) {
+            continue;
+        }
+        size_t k = 1;
+        while (k < len && fold(p[k]) == fold(query[k])) {
+            k++;
+        }
+        if (k == len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pif_library_search(const struct pif_library *lib, const char *query, size_t len, uint32_t **rows,
+                       uint32_t *count) {
+    // Short queries have no trigram to narrow by, so check every song
+    const uint32_t *candidates = NULL;
+    uint32_t n = lib->count;
+    if (len >= 3 && lib->names.capacity != 0) {
+        candidates = trigram_candidates(&lib->names, query, len, &n);
+    }
+
+    *count = 0;
+    *rows = lib_alloc(lib, (n ? n : 1) * sizeof(**rows));
+    if (*rows == NULL) {
+        return -1;
+    }
+    // Ids grow with row, so the candidates come out in library order
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = candidates != NULL ? lib->row_of[candidates[k]] : k;
+        if (i < lib->count && pif_song_matches(&lib->songs[i], query, len)) {
+            (*rows)[(*count)++] = i;
+        }
+    }
+    return 0;
+}
+
+static int rebuild_rotation(struct pif_library *lib) {
+    uint32_t *rotation = lib_alloc(lib, (lib->count ? lib->count : 1) * sizeof(*rotation));
+    if (rotation == NULL) {
+        return -1;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < lib->count; i++) {
+        if (lib->songs[i].freq == PIF_FREQ_ROT) {
+            rotation[n++] = i;
+        }
+    }
+    if (lib->rotation != lib->db.rot_index) {
+        lib_free(lib, lib->rotation);
+    }
+    lib->rotation = rotation;
+    lib->rot_count = n;
+    lib->rotation_dirty = 0;
+    return 0;
+}
+
+static uint32_t pick_rotation(struct pif_library *lib, struct pif_config *config, uint32_t *out) {
+    if (lib->rotation_dirty && rebuild_rotation(lib) == -1) {
+        return 0;
+    }
+
+    uint32_t total = lib->rot_count;
+    if (total == 0 || config->songs_per_day <= 0) {
+        return 0;
+    }
+
+    // Wrap around the end of the list so we always return a full day
+    uint32_t start = (uint32_t)config->last_played % total;
+    uint32_t count = (uint32_t)config->songs_per_day < total ? (uint32_t)config->songs_per_day : total;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = lib->rotation[(start + i) % total];
+    }
+
+    config->last_played = (int)((start + count) % total);
+    return count;
+}
+
+uint32_t pif_library_rotation(struct pif_library *lib, struct pif_config *config, uint32_t *out) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    uint32_t rc = pick_rotation(lib, config, out);
+    pif_trace_end(&span, PIF_PHASE_ROTATION);
+    return rc;
+}
+
+int pif_library_is_due(const struct pif_song *song, time_t now) {
+    return song->freq > 0 &&
+           (song->last_practice == 0 || (now - song->last_practice) / PIF_SECONDS_PER_DAY >= song->freq);
+}
+
+int pif_library_refresh(struct pif_library *lib, const uint32_t *rows, uint32_t n) {
+    struct practice_query *queries = lib_calloc(lib, n ? n : 1, sizeof(*queries));
+    if (queries == NULL) {
+        return -1;
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        const struct pif_song *song = &lib->songs[rows[k]];
+        queries[k] = (struct practice_query){ song->line, song->name_len, 0 };
+    }
+    if (practice_source_lookup(&lib->practice, queries, n) == -1) {
+        lib_free(lib, queries);
+        return -1;
+    }
+
+    for (uint32_t k = 0; k < n; k++) {
+        pif_library_set_practiced(lib, rows[k], queries[k].when);
+    }
+    lib_free(lib, queries);
+    return 0;
+}
+
+void pif_library_set_practiced(struct pif_library *lib, uint32_t row, int64_t when) {
+    struct pif_song *song = &lib->songs[row];
+    song->last_practice = when;
+
+    // Keep the snapshot's cache up to date for the next run
+    if (song->snapshot != 0 && lib->db.last_practice[song->snapshot - 1] != when) {
+        lib->db.last_practice[song->snapshot - 1] = when;
+    }
+}
+
+// Heapify every frequency song by its cached due time
+static int build_schedule(struct pif_library *lib) {
+    struct due_entry *entries = lib_alloc(lib, (lib->count ? lib->count : 1) * sizeof(*entries));
+    if (entries == NULL) {
+        return -1;
+    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < lib->count; i++) {
+        if (lib->songs[i].freq > 0) {
+            entries[n++] = (struct due_entry){ pif_song_due_time(&lib->songs[i]), lib->songs[i].id };
+        }
+    }
+    int rc = due_heap_build(&lib->schedule, entries, n, lib->next_id);
+    lib_free(lib, entries);
+    lib->schedule_valid = rc == 0;
+    return rc;
+}
+
+// Rows of the songs scheduled at or before limit, in no particular order
+static int collect_scheduled(struct pif_library *lib, int64_t limit, uint32_t **rows, uint32_t *n) {
+    if (due_heap_collect(&lib->schedule, limit, rows, n) == -1) {
+        return -1;
+    }
+    for (uint32_t k = 0; k < *n; k++) {
+        (*rows)[k] = lib->row_of[(*rows)[k]];
+    }
+    return 0;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Put distinct rows below limit in order. Once they are a sizeable share
+// of the library a bitmap pass beats comparison sorting.
+static void sort_rows(const struct pif_library *lib, uint32_t *rows, uint32_t n, uint32_t limit) {
+    uint64_t *bits = n > limit / 64 ? lib_calloc(lib, limit / 64 + 1, sizeof(*bits)) : NULL;
+    if (bits == NULL) {
+        qsort(rows, n, sizeof(*rows), compare_rows);
+        return;
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        bits[rows[k] / 64] |= UINT64_C(1) << (rows[k] % 64);
+    }
+    uint32_t k = 0;
+    for (uint32_t w = 0; w <= limit / 64; w++) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            rows[k++] = w * 64 + (uint32_t)__builtin_ctzll(word);
+        }
+    }
+    lib_free(lib, bits);
+}
+
+static int collect_due(struct pif_library *lib, time_t now, uint32_t **due, uint32_t *num_due) {
+    *due = NULL;
+    *num_due = 0;
+    if (!lib->schedule_valid && build_schedule(lib) == -1) {
+        return -1;
+    }
+
+    // Practicing only moves a due time later, so scheduled times can be
+    // early but never late: everything due is among the entries up to now
+    uint32_t *songs;
+    uint32_t n;
+    if (collect_scheduled(lib, now, &songs, &n) == -1) {
+        return -1;
+    }
+
+    // Confirm the candidates in a single batch, moving the ones practiced
+    // since their time was cached
+    if (pif_library_refresh(lib, songs, n) == -1) {
+        int saved = errno;
+        lib_free(lib, songs);
+        errno = saved;
+        return -1;
+    }
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        const struct pif_song *song = &lib->songs[songs[k]];
+        if (pif_library_is_due(song, now)) {
+            songs[kept++] = songs[k];
+        } else {
+            due_heap_update(&lib->schedule, song->id, pif_song_due_time(song));
+        }
+    }
+    sort_rows(lib, songs, kept, lib->count);
+
+    *due = songs;
+    *num_due = kept;
+    return 0;
+}
+
+int pif_library_due(struct pif_library *lib, time_t now, uint32_t **due, uint32_t *num_due) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = collect_due(lib, now, due, num_due);
+    pif_trace_end(&span, PIF_PHASE_DUE);
+    return rc;
+}
+
+static int find_next_due(struct pif_library *lib, uint32_t *row, int64_t *when) {
+    if (!lib->schedule_valid && build_schedule(lib) == -1) {
+        return -1;
+    }
+
+    // The top entry may be early if the song was practiced since its time
+    // was cached, so settle it before trusting it
+    const struct due_entry *top;
+    while ((top = due_heap_top(&lib->schedule)) != NULL) {
+        uint32_t id = top->id;
+        uint32_t candidate = lib->row_of[id];
+        if (pif_library_refresh(lib, &candidate, 1) == -1) {
+            return -1;
+        }
+        int64_t fresh = pif_song_due_time(&lib->songs[candidate]);
+        if (fresh == top->when) {
+            *row = candidate;
+            *when = fresh;
+            return 1;
+        }
+        due_heap_update(&lib->schedule, id, fresh);
+    }
+    return 0;
+}
+
+int pif_library_next_due(struct pif_library *lib, uint32_t *row, int64_t *when) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = find_next_due(lib, row, when);
+    pif_trace_end(&span, PIF_PHASE_DUE);
+    return rc;
+}
+
+// First day of a plan starting at now on which song is due
+static uint32_t first_due_day(const struct pif_song *song, time_t now) {
+    int64_t t = pif_song_due_time(song);
+    return t <= now ? 0 : (uint32_t)((t - now + PIF_SECONDS_PER_DAY - 1) / PIF_SECONDS_PER_DAY);
+}
+
+static int make_plan(struct pif_library *lib, const struct pif_config *config, time_t now, uint32_t days,
+                     struct pif_plan *plan) {
+    memset(plan, 0, sizeof(*plan));
+    if (lib->rotation_dirty && rebuild_rotation(lib) == -1) {
+        return -1;
+    }
+
+    // The rotation cursor moves by the same step every day
+    plan->days = days;
+    if (lib->rot_count > 0 && config->songs_per_day > 0) {
+        plan->rot_start = (uint32_t)config->last_played % lib->rot_count;
+        plan->rot_per_day =
+            (uint32_t)config->songs_per_day < lib->rot_count ? (uint32_t)config->songs_per_day : lib->rot_count;
+    }
+
+    plan->arena = lib->run;
+    plan->due_start = lib_calloc(lib, (size_t)days + 1, sizeof(*plan->due_start));
+    if (plan->due_start == NULL) {
+        return -1;
+    }
+    if (days == 0) {
+        return 0;
+    }
+    if (!lib->schedule_valid && build_schedule(lib) == -1) {
+        pif_plan_free(plan);
+        return -1;
+    }
+
+    // Only songs scheduled by the last day can show up, and cached times
+    // are never late, so those are all that need confirming
+    int64_t horizon = (int64_t)now + (int64_t)(days - 1) * PIF_SECONDS_PER_DAY;
+    uint32_t *songs;
+    uint32_t n;
+    if (collect_scheduled(lib, horizon, &songs, &n) == -1) {
+        pif_plan_free(plan);
+        return -1;
+    }
+    if (pif_library_refresh(lib, songs, n) == -1) {
+        int saved = errno;
+        lib_free(lib, songs);
+        pif_plan_free(plan);
+        errno = saved;
+        return -1;
+    }
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        const struct pif_song *song = &lib->songs[songs[k]];
+        int64_t t = pif_song_due_time(song);
+        due_heap_update(&lib->schedule, song->id, t);
+        if (t <= horizon) {
+            songs[kept++] = songs[k];
+        }
+    }
+    sort_rows(lib, songs, kept, lib->count);
+
+    // A song recurs every freq days from the first day it is due. Count
+    // each day's songs, then fill the days in library order.
+    for (uint32_t k = 0; k < kept; k++) {
+        const struct pif_song *song = &lib->songs[songs[k]];
+        for (uint32_t d = first_due_day(song, now); d < days; d += (uint32_t)song->freq) {
+            plan->due_start[d + 1]++;
+        }
+    }
+    for (uint32_t d = 0; d < days; d++) {
+        plan->due_start[d + 1] += plan->due_start[d];
+    }
+    size_t *fill = lib_alloc(lib, (size_t)days * sizeof(*fill));
+    plan->due = lib_alloc(lib, (plan->due_start[days] ? plan->due_start[days] : 1) * sizeof(*plan->due));
+    if (fill == NULL || plan->due == NULL) {
+        lib_free(lib, fill);
+        lib_free(lib, songs);
+        pif_plan_free(plan);
+        return -1;
+    }
+    memcpy(fill, plan->due_start, (size_t)days * sizeof(*fill));
+    for (uint32_t k = 0; k < kept; k++) {
+        const struct pif_song *song = &lib->songs[songs[k]];
+        for (uint32_t d = first_due_day(song, now); d < days; d += (uint32_t)song->freq) {
+            plan->due[fill[d]++] = songs[k];
+        }
+    }
+    lib_free(lib, fill);
+    lib_free(lib, songs);
+    return 0;
+}
+
+int pif_library_plan(struct pif_library *lib, const struct pif_config *config, time_t now, uint32_t days,
+                     struct pif_plan *plan) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = make_plan(lib, config, now, days, plan);
+    pif_trace_end(&span, PIF_PHASE_DUE);
+    return rc;
+}
+
+void pif_plan_free(struct pif_plan *plan) {
+    if (plan->arena == NULL) {
+        free(plan->due_start);
+        free(plan->due);
+    }
+    memset(plan, 0, sizeof(*plan));
+}
+
+void pif_print_rotation(FILE *out, const struct pif_library *lib, const uint32_t *rows, uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    fprintf(out, "Today's rotation songs to practice:\n");
+    for (uint32_t i = 0; i < n; i++) {
+        const struct pif_song *song = &lib->songs[rows[i]];
+        fprintf(out, "%u. %.*s\n", i + 1, (int)song->name_len, song->line);
+    }
+}
+
+void pif_print_due(FILE *out, const struct pif_library *lib, const uint32_t *rows, uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    fprintf(out, "Songs due for practice based on frequency:\n");
+    for (uint32_t k = 0; k < n; k++) {
+        const struct pif_song *song = &lib->songs[rows[k]];
+        size_t freq_len;
+        const char *freq = pif_song_freq_text(song, &freq_len);
+        fprintf(out, "- %.*s (every %.*s days)\n", (int)song->name_len, song->line, (int)freq_len, freq);
+    }
+}
+
+void pif_print_plan(FILE *out, const struct pif_library *lib, const struct pif_plan *plan, time_t now) {
+    struct tm today;
+    localtime_r(&now, &today);
+    for (uint32_t d = 0; d < plan->days; d++) {
+        // Step by calendar day so DST changes never skip or repeat a date
+        struct tm tm = today;
+        tm.tm_mday += (int)d;
+        tm.tm_hour = 12;
+        tm.tm_isdst = -1;
+        mktime(&tm);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+        fprintf(out, "%s%s:\n", d > 0 ? "\n" : "", date);
+
+        uint64_t start = plan->rot_start + (uint64_t)d * plan->rot_per_day;
+        for (uint32_t i = 0; i < plan->rot_per_day; i++) {
+            const struct pif_song *song = &lib->songs[lib->rotation[(start + i) % lib->rot_count]];
+            fprintf(out, "  %u. %.*s\n", i + 1, (int)song->name_len, song->line);
+        }
+        for (size_t k = plan->due_start[d]; k < plan->due_start[d + 1]; k++) {
+            const struct pif_song *song = &lib->songs[plan->due[k]];
+            size_t freq_len;
+            const char *freq = pif_song_freq_text(song, &freq_len);
+            fprintf(out, "  - %.*s (every %.*s days)\n", (int)song->name_len, song->line, (int)freq_len, freq);
+        }
+    }
+}
+
+void pif_print_next_due(FILE *out, const struct pif_library *lib, uint32_t row, int64_t when, time_t now) {
+    const struct pif_song *song = &lib->songs[row];
+    time_t t = when > now ? (time_t)when : now;
+    struct tm tm;
+    char stamp[64];
+    if (localtime_r(&t, &tm) == NULL || strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S%z", &tm) == 0) {
+        snprintf(stamp, sizeof(stamp), "@%lld", (long long)t);
+    }
+    fprintf(out, "%s %.*s\n", stamp, (int)song->name_len, song->line);
+}
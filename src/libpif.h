@@ -0,0 +1,218 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBPIF_H
+#define LIBPIF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "names.h"
+#include "pifdb.h"
+#include "practice.h"
+#include "trigram.h"
+#include "schedule.h"
+
+// Core engine shared by pif and pif-gtk: the rotation config, the song
+// table and the rotation and due-ness queries. Functions return 0 on
+// success or -1 with errno set; reporting errors is up to the caller.
+
+#define PIF_SECONDS_PER_DAY (24 * 3600)
+
+// Rotation configuration. It lives in the shared state file (state.h);
+// ~/.pif-config is only read to create that the first time.
+struct pif_config {
+    int songs_per_day;
+    int last_played;  // Index of the next rotation song to play
+};
+
+#define PIF_CONFIG_INIT { 3, 0 }
+
+// A missing file leaves the defaults in place
+int pif_config_load(struct pif_config *config, const char *path);
+
+#define PIF_FREQ_NONE 0
+#define PIF_FREQ_ROT (-1)
+
+// One line of ~/.pif. Records are contiguous; their text lives either in
+// the mapped snapshot or in the library's text arena.
+struct pif_song {
+    const char *line;  // "name freq", NUL-terminated
+    uint32_t line_len;
+    uint32_t name_len;  // Up to the last space, or the whole line
+    int32_t freq;       // Days between practices, PIF_FREQ_ROT or PIF_FREQ_NONE
+    uint32_t snapshot;  // Row in the snapshot plus one, 0 if not from it
+    uint32_t id;        // Kept while other songs come and go; grows with row
+    int64_t last_practice;
+};
+
+// The name indexes and the schedule refer to songs by id rather than
+// row, so removing a song only has to move the rows after it down and
+// note their new rows in row_of: two sequential passes over the tail of
+// the library, O(n) at memmove speed, but no index is rewritten.
+struct pif_library {
+    struct pif_song *songs;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *row_of;  // Row of each id, UINT32_MAX once its song is gone
+    uint32_t next_id;
+    uint32_t id_capacity;
+    struct pif_arena text;  // Lines added or changed since the snapshot
+    struct pif_arena *run;  // Set by pif_library_open_run, otherwise NULL
+    struct pifdb db;
+    struct practice_source practice;
+    uint32_t *rotation;  // Rotation songs in order, rebuilt after edits
+    uint32_t rot_count;
+    int rotation_dirty;
+    size_t journal_applied;  // Bytes of ~/.pif.journal replayed on open
+    uint64_t journal_dev;    // Which journal file that was
+    uint64_t journal_ino;
+    struct trigram_index names;  // Only built by pif_library_index
+    struct name_index by_name;   // Built on the first lookup by name
+    struct due_heap schedule;    // Frequency songs by next due time
+    int schedule_valid;          // Rebuilt on the next due query if not
+};
+
+// Load ~/.pif through its snapshot and replay ~/.pif.journal on top.
+// Last-practiced times come from the practice log or legacy files in
+// practice_dir.
+int pif_library_open(struct pif_library *lib, const char *fileloc, const char *practice_dir);
+
+// Like pif_library_open, for a library that lives no longer than run: the
+// song table, the schedule, the practice index and every list handed back
+// (due songs, search results, plans) are allocated from run, are not freed
+// by the caller or by pif_library_close, and all go with run.
+int pif_library_open_run(struct pif_library *lib, const char *fileloc, const char *practice_dir,
+                         struct pif_arena *run);
+void pif_library_close(struct pif_library *lib);
+
+// Append a "name freq" line, copying it into the text arena
+int pif_library_append(struct pif_library *lib, const char *line, size_t len);
+
+// Append a line unless a song of that name is already there, in which
+// case fail with EEXIST
+int pif_library_add(struct pif_library *lib, const char *line, size_t len);
+
+// Find the song called name in constant time. Returns 1 and sets *row if
+// there is one, 0 if not or -1 with errno set.
+int pif_library_find(struct pif_library *lib, const char *name, size_t len, uint32_t *row);
+
+// Drop song i, shifting the rest up
+int pif_library_remove(struct pif_library *lib, uint32_t i);
+
+// Replace the line of song i, keeping its practice time if the name is
+// unchanged
+int pif_library_replace(struct pif_library *lib, uint32_t i, const char *line, size_t len);
+
+// Build the name search and lookup indexes, which edits then keep up to
+// date
+int pif_library_index(struct pif_library *lib);
+
+// Songs whose name contains query, ignoring ASCII case, in library order.
+// Uses the name index when built. The caller frees *rows, as with every
+// list below, unless the library has a run arena.
+int pif_library_search(const struct pif_library *lib, const char *query, size_t len, uint32_t **rows,
+                       uint32_t *count);
+
+// Whether the name of song contains query, ignoring ASCII case
+int pif_song_matches(const struct pif_song *song, const char *query, size_t len);
+
+// Pick today's rotation songs into out, which must have room for
+// config->songs_per_day entries, and advance config->last_played.
+// Returns the number of songs picked.
+uint32_t pif_library_rotation(struct pif_library *lib, struct pif_config *config, uint32_t *out);
+
+// Every due frequency song, in library order. The caller frees *due.
+// Only the k songs at the top of the schedule are looked at, so this is
+// O(k log n) once the schedule is built.
+int pif_library_due(struct pif_library *lib, time_t now, uint32_t **due, uint32_t *num_due);
+
+// The frequency song that falls due first and when, with its practice time
+// confirmed. Returns 1 if there is one, 0 if there are no frequency songs
+// or -1 with errno set.
+int pif_library_next_due(struct pif_library *lib, uint32_t *row, int64_t *when);
+
+// Projection of the next days of practice, assuming each day's songs are
+// practiced on that day. Day d picks rotation songs rot_per_day at a time
+// from position (rot_start + d * rot_per_day) in the rotation, wrapping
+// around, and its due songs are due[due_start[d]] up to due[due_start[d + 1]],
+// in library order.
+struct pif_plan {
+    uint32_t days;
+    uint32_t rot_start;
+    uint32_t rot_per_day;
+    size_t *due_start;
+    uint32_t *due;
+    struct pif_arena *arena;  // Where due_start and due live, NULL if malloc'd
+};
+
+// Project days days from now without changing config or any file. Only
+// the songs scheduled within the horizon have their practice times
+// looked up.
+int pif_library_plan(struct pif_library *lib, const struct pif_config *config, time_t now, uint32_t days,
+                     struct pif_plan *plan);
+void pif_plan_free(struct pif_plan *plan);
+
+// When a frequency song falls due going by its cached last-practice time;
+// 0 if it has never been practiced
+static inline int64_t pif_song_due_time(const struct pif_song *song) {
+    return song->last_practice == 0 ? 0 : song->last_practice + (int64_t)song->freq * PIF_SECONDS_PER_DAY;
+}
+
+// Whether a frequency song is due going by its cached last-practice time.
+// The cache can only be stale in the "due" direction.
+int pif_library_is_due(const struct pif_song *song, time_t now);
+
+// Re-read the last-practice times of the given songs in one batch
+int pif_library_refresh(struct pif_library *lib, const uint32_t *rows, uint32_t n);
+
+// Store a last-practice time looked up elsewhere, as pif_library_refresh
+// would, for callers that query the history off the library's thread
+void pif_library_set_practiced(struct pif_library *lib, uint32_t row, int64_t when);
+
+// Frequency text after the last space, or an empty span if there is none
+static inline const char *pif_song_freq_text(const struct pif_song *song, size_t *len) {
+    if (song->name_len == song->line_len) {
+        *len = 0;
+        return song->line + song->line_len;
+    }
+    *len = song->line_len - song->name_len - 1;
+    return song->line + song->name_len + 1;
+}
+
+// Print rotation or due songs in pif's output format, heading included.
+// Nothing is printed for an empty list.
+void pif_print_rotation(FILE *out, const struct pif_library *lib, const uint32_t *rows, uint32_t n);
+void pif_print_due(FILE *out, const struct pif_library *lib, const uint32_t *rows, uint32_t n);
+
+// Print a plan day by day under each day's date
+void pif_print_plan(FILE *out, const struct pif_library *lib, const struct pif_plan *plan, time_t now);
+
+// Print when a song falls due, or now if it already is, as an ISO 8601
+// local time followed by the song's name
+void pif_print_next_due(FILE *out, const struct pif_library *lib, uint32_t row, int64_t when, time_t now);
+
+// Split a line at its last space and classify the frequency
+void pif_parse_line(const char *line, size_t len, uint32_t *name_len, int32_t *freq);
+
+// Classify the text after a line's last space: days, rot or none
+int32_t pif_parse_freq(const char *f, size_t len);
+
+#endif
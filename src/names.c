@@ -0,0 +1,159 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "names.h"
+#include "libpif.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// FNV-1a folded to 32 bits, as the slot only has room for that much
+static uint32_t hash_name(const char *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint64_t make_slot(uint32_t hash, uint32_t id) {
+    return (uint64_t)hash << 32 | (id + 1);
+}
+
+static uint32_t slot_hash(uint64_t slot) {
+    return (uint32_t)(slot >> 32);
+}
+
+static uint32_t slot_id(uint64_t slot) {
+    return (uint32_t)slot - 1;
+}
+
+static void place(uint64_t *slots, uint32_t capacity, uint64_t slot) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = slot_hash(slot) & mask;
+    while (slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+}
+
+static int grow(struct name_index *index, uint32_t want) {
+    uint32_t capacity = index->capacity ? index->capacity : 1024;
+    while ((uint64_t)want * 10 > (uint64_t)capacity * 7) {
+        if (capacity > UINT32_MAX / 2) {
+            errno = ENOMEM;
+            return -1;
+        }
+        capacity *= 2;
+    }
+    if (capacity == index->capacity) {
+        return 0;
+    }
+    uint64_t *slots = calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < index->capacity; i++) {
+        if (index->slots[i] != 0) {
+            place(slots, capacity, index->slots[i]);
+        }
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return 0;
+}
+
+static uint64_t song_slot(const struct pif_song *song) {
+    return make_slot(hash_name(song->line, song->name_len), song->id);
+}
+
+void name_index_free(struct name_index *index) {
+    free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
+
+int name_index_build(struct name_index *index, const struct pif_song *songs, uint32_t count) {
+    name_index_free(index);
+    if (grow(index, count) == -1) {
+        return -1;
+    }
+    for (uint32_t row = 0; row < count; row++) {
+        place(index->slots, index->capacity, song_slot(&songs[row]));
+    }
+    index->used = count;
+    return 0;
+}
+
+uint32_t name_index_find(const struct name_index *index, const struct pif_song *songs, const uint32_t *row_of,
+                         const char *name, size_t len) {
+    if (index->capacity == 0) {
+        return UINT32_MAX;
+    }
+    uint32_t hash = hash_name(name, len);
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t i = hash & mask; index->slots[i] != 0; i = (i + 1) & mask) {
+        uint64_t slot = index->slots[i];
+        if (slot_hash(slot) != hash) {
+            continue;
+        }
+        uint32_t row = row_of[slot_id(slot)];
+        const struct pif_song *song = &songs[row];
+        if (song->name_len == len && memcmp(song->line, name, len) == 0) {
+            return row;
+        }
+    }
+    return UINT32_MAX;
+}
+
+int name_index_add(struct name_index *index, const struct pif_song *songs, uint32_t row) {
+    if (grow(index, index->used + 1) == -1) {
+        return -1;
+    }
+    place(index->slots, index->capacity, song_slot(&songs[row]));
+    index->used++;
+    return 0;
+}
+
+void name_index_remove(struct name_index *index, const struct pif_song *songs, uint32_t row) {
+    if (index->capacity == 0) {
+        return;
+    }
+    uint32_t mask = index->capacity - 1;
+    uint64_t target = song_slot(&songs[row]);
+    uint32_t i = slot_hash(target) & mask;
+    while (index->slots[i] != 0 && index->slots[i] != target) {
+        i = (i + 1) & mask;
+    }
+    if (index->slots[i] != 0) {
+        // Backward-shift deletion: pull later entries of the run into the
+        // hole unless that would put them before their home slot
+        index->slots[i] = 0;
+        index->used--;
+        for (uint32_t j = (i + 1) & mask; index->slots[j] != 0; j = (j + 1) & mask) {
+            uint32_t home = slot_hash(index->slots[j]) & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                index->slots[i] = index->slots[j];
+                index->slots[j] = 0;
+                i = j;
+            }
+        }
+    }
+}
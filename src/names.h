@@ -0,0 +1,56 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct pif_song;
+
+// Open-addressing hash index from song name to row, so a song can be
+// found by name without walking the library. Every song is in it, even
+// when a name repeats in an old file; slots hold the song's id and part of
+// the name's hash, and names are compared against the song table itself.
+// Ids do not change when other songs are removed, so neither do the
+// slots; only the library's row_of table follows the rows.
+struct name_index {
+    uint64_t *slots;    // Hash << 32 | (id + 1), 0 for an empty slot
+    uint32_t capacity;  // Power of two, 0 if the index was never built
+    uint32_t used;
+};
+
+void name_index_free(struct name_index *index);
+
+// Index rows 0 to count - 1 of songs from scratch
+int name_index_build(struct name_index *index, const struct pif_song *songs, uint32_t count);
+
+// Row of a song called name, or UINT32_MAX if there is none. row_of maps
+// each id to its row.
+uint32_t name_index_find(const struct name_index *index, const struct pif_song *songs, const uint32_t *row_of,
+                         const char *name, size_t len);
+
+// Record songs[row] under its name
+int name_index_add(struct name_index *index, const struct pif_song *songs, uint32_t row);
+
+// Forget songs[row], which must still hold the name and id it was added
+// under
+void name_index_remove(struct name_index *index, const struct pif_song *songs, uint32_t row);
+
+#endif
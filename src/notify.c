@@ -0,0 +1,189 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "notify.h"
+#include "trace.h"
+
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NOTIFY_NAME "org.freedesktop.Notifications"
+#define NOTIFY_PATH "/org/freedesktop/Notifications"
+#define NOTIFY_IFACE "org.freedesktop.Notifications"
+
+struct notify_wait {
+    GMainLoop *loop;
+    guint32 id;
+    guint timeout;  // 0 once it has fired
+    gboolean open;
+    gchar *token;  // Activation token for pif-gtk, if the server sent one
+};
+
+static void on_notify_signal(GDBusConnection *bus, const gchar *sender, const gchar *path, const gchar *iface,
+                             const gchar *signal, GVariant *params, gpointer data) {
+    (void)bus;     // Suppress unused parameter warning
+    (void)sender;  // Suppress unused parameter warning
+    (void)path;    // Suppress unused parameter warning
+    (void)iface;   // Suppress unused parameter warning
+    struct notify_wait *wait = data;
+    guint32 id;
+    if (g_strcmp0(signal, "ActivationToken") == 0 && g_variant_is_of_type(params, G_VARIANT_TYPE("(us)"))) {
+        const gchar *token;
+        g_variant_get(params, "(u&s)", &id, &token);
+        if (id == wait->id) {
+            g_free(wait->token);
+            wait->token = g_strdup(token);
+        }
+    } else if (g_strcmp0(signal, "ActionInvoked") == 0 && g_variant_is_of_type(params, G_VARIANT_TYPE("(us)"))) {
+        // Both actions open pif-gtk
+        g_variant_get(params, "(u&s)", &id, NULL);
+        if (id == wait->id) {
+            wait->open = TRUE;
+            g_main_loop_quit(wait->loop);
+        }
+    } else if (g_strcmp0(signal, "NotificationClosed") == 0 &&
+               g_variant_is_of_type(params, G_VARIANT_TYPE("(uu)"))) {
+        g_variant_get(params, "(uu)", &id, NULL);
+        if (id == wait->id) {
+            g_main_loop_quit(wait->loop);
+        }
+    }
+}
+
+static gboolean on_wait_timeout(gpointer data) {
+    struct notify_wait *wait = data;
+    wait->timeout = 0;
+    g_main_loop_quit(wait->loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Whether the server lists capability
+static gboolean has_capability(GVariant *caps, const char *capability) {
+    GVariantIter iter;
+    const gchar *cap;
+    g_variant_iter_init(&iter, caps);
+    while (g_variant_iter_next(&iter, "&s", &cap)) {
+        if (strcmp(cap, capability) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean launch_gtk(const gchar *token, GError **error) {
+    gchar **env = g_get_environ();
+    if (token != NULL) {
+        env = g_environ_setenv(env, "XDG_ACTIVATION_TOKEN", token, TRUE);
+    }
+    gchar *argv[] = { "pif-gtk", NULL };
+    gboolean ok = g_spawn_async(NULL, argv, env, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, error);
+    g_strfreev(env);
+    return ok;
+}
+
+int pif_notify(const char *body, char *err, size_t err_size) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    GError *error = NULL;
+    GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (bus == NULL) {
+        pif_trace_end(&span, PIF_PHASE_NOTIFY);
+        snprintf(err, err_size, "%s", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    int rc = -1;
+    struct notify_wait wait = { g_main_loop_new(NULL, FALSE), 0, 0, FALSE, NULL };
+    gchar *text = NULL;
+    GVariant *caps = NULL;
+    GVariant *reply = NULL;
+    gboolean timing = TRUE;
+
+    // Subscribe first: signals queue up until the loop runs, by which time
+    // the notification id is known
+    guint subscription = g_dbus_connection_signal_subscribe(bus, NOTIFY_NAME, NOTIFY_IFACE, NULL, NOTIFY_PATH, NULL,
+                                                            G_DBUS_SIGNAL_FLAGS_NONE, on_notify_signal, &wait, NULL);
+
+    reply = g_dbus_connection_call_sync(bus, NOTIFY_NAME, NOTIFY_PATH, NOTIFY_IFACE, "GetCapabilities", NULL,
+                                        G_VARIANT_TYPE("(as)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    if (reply == NULL) {
+        goto out;
+    }
+    caps = g_variant_get_child_value(reply, 0);
+    g_variant_unref(reply);
+    gboolean actions = has_capability(caps, "actions");
+
+    // Without markup support the text would show up escaped
+    text = has_capability(caps, "body-markup") ? g_markup_escape_text(body, -1) : g_strdup(body);
+    g_strchomp(text);
+
+    GVariantBuilder action_list;
+    g_variant_builder_init(&action_list, G_VARIANT_TYPE("as"));
+    if (actions) {
+        g_variant_builder_add(&action_list, "s", "default");
+        g_variant_builder_add(&action_list, "s", "Open pif-gtk");
+        g_variant_builder_add(&action_list, "s", "open");
+        g_variant_builder_add(&action_list, "s", "Open pif-gtk");
+    }
+    GVariantBuilder hints;
+    g_variant_builder_init(&hints, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&hints, "{sv}", "desktop-entry", g_variant_new_string("pif-gtk"));
+
+    reply = g_dbus_connection_call_sync(
+        bus, NOTIFY_NAME, NOTIFY_PATH, NOTIFY_IFACE, "Notify",
+        g_variant_new("(susssasa{sv}i)", "pif", 0, "pif-gtk", PIF_NOTIFY_SUMMARY, text, &action_list, &hints, -1),
+        G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    pif_trace_end(&span, PIF_PHASE_NOTIFY);  // Not the wait for the user below
+    timing = FALSE;
+    if (reply == NULL) {
+        goto out;
+    }
+    g_variant_get(reply, "(u)", &wait.id);
+    g_variant_unref(reply);
+
+    if (actions) {
+        wait.timeout = g_timeout_add_seconds(PIF_NOTIFY_WAIT_SEC, on_wait_timeout, &wait);
+        g_main_loop_run(wait.loop);
+        if (wait.timeout != 0) {
+            g_source_remove(wait.timeout);
+        }
+        if (wait.open && !launch_gtk(wait.token, &error)) {
+            goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    if (timing) {
+        pif_trace_end(&span, PIF_PHASE_NOTIFY);
+    }
+    if (error != NULL) {
+        snprintf(err, err_size, "%s", error->message);
+        g_error_free(error);
+    }
+    g_dbus_connection_signal_unsubscribe(bus, subscription);
+    if (caps != NULL) {
+        g_variant_unref(caps);
+    }
+    g_free(text);
+    g_free(wait.token);
+    g_main_loop_unref(wait.loop);
+    g_object_unref(bus);
+    return rc;
+}
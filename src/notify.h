@@ -0,0 +1,34 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include <stddef.h>
+
+// Desktop notifications for pif --notify, sent straight to
+// org.freedesktop.Notifications on the session bus. The bus comes from
+// DBUS_SESSION_BUS_ADDRESS, so dbus-run-session can stand in for it.
+#define PIF_NOTIFY_SUMMARY "PIF Rotation"
+#define PIF_NOTIFY_WAIT_SEC 3600  // How long the notification can still open pif-gtk
+
+// Show body as a notification with an action that opens pif-gtk. If the
+// server supports actions, wait until the notification is closed or an
+// action is picked. Returns 0 on success or -1 with a message in err.
+int pif_notify(const char *body, char *err, size_t err_size);
+
+#endif
@@ -26,14 +26,40 @@
 #include <sys/stat.h>
 #include <errno.h>
 
+#include "libpif.h"
+#include "import.h"
+#include "journal.h"
+#include "pif-song-model.h"
+#include "pif-writer.h"
+#include "state.h"
+#include "trace.h"
+
 // Global variables
 GtkWidget *song_list;
+PifSongModel *song_model;
+GtkWidget *load_progress;
 GtkWidget *song_entry;
 GtkWidget *freq_entry;
+GtkWidget *search_entry;
 char *fileloc;
-char *configloc;  // New config file location
-int songs_per_day = 3;  // Default value
-int last_played = 0;    // Track last played song
+char *configloc;  // Legacy config, only read to seed the state file
+char *stateloc;
+char *journal_loc;
+char *practice_loc;
+struct pif_state state = { -1, NULL };
+static GCancellable *load_cancellable;
+static guint load_pulse;
+static guint reload_timeout;
+static guint practice_timeout;
+static GFileMonitor *monitors[3];
+static off_t journal_size;  // Journal size after our last append
+static guint pending_edits;  // Queued for the writer but not yet written
+static guint edit_gen;       // Bumped on every edit
+static guint load_gen;       // edit_gen when the running load started
+static gboolean reload_wanted;
+static GtkWidget *import_item;
+
+void load_songs(void);
 
 void handle_error(const char *msg) {
     GtkWidget *dialog = gtk_message_dialog_new(NULL,
@@ -47,79 +73,286 @@ void handle_error(const char *msg) {
     gtk_widget_destroy(dialog);
 }
 
-void load_songs(void) {
-    FILE *file = fopen(fileloc, "r");
-    if (file == NULL) {
-        if (errno != ENOENT) {
-            handle_error("Failed to open file");
+void handle_gerror(const char *msg, const GError *error) {
+    GtkWidget *dialog = gtk_message_dialog_new(NULL,
+        GTK_DIALOG_MODAL,
+        GTK_MESSAGE_ERROR,
+        GTK_BUTTONS_OK,
+        "Error: %s: %s",
+        msg,
+        error->message);
+    gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+}
+
+void open_rotation_state(void) {
+    if (pif_state_open(&state, stateloc, configloc) == -1) {
+        handle_error("Failed to open rotation state");
+        exit(1);
+    }
+}
+
+static void free_library(gpointer data) {
+    pif_library_close(data);
+    g_free(data);
+}
+
+static void load_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+    (void)source;       // Suppress unused parameter warning
+    (void)data;         // Suppress unused parameter warning
+    (void)cancellable;  // Suppress unused parameter warning
+
+    // Go through the shared library, which keeps ~/.pifdb up to date
+    struct pif_library *lib = g_new(struct pif_library, 1);
+    if (pif_library_open(lib, fileloc, getenv("HOME")) == -1) {
+        int saved = errno;
+        g_free(lib);
+        g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(saved), "%s", g_strerror(saved));
+        return;
+    }
+
+    // Search goes through a name index, built here rather than on the
+    // main thread
+    if (pif_library_index(lib) == -1) {
+        int saved = errno;
+        free_library(lib);
+        g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(saved), "%s", g_strerror(saved));
+        return;
+    }
+    g_task_return_pointer(task, lib, free_library);
+}
+
+static void load_done(GObject *source, GAsyncResult *result, gpointer data) {
+    (void)source;  // Suppress unused parameter warning
+    GCancellable *cancellable = data;
+
+    GError *error = NULL;
+    struct pif_library *lib = g_task_propagate_pointer(G_TASK(result), &error);
+    if (g_cancellable_is_cancelled(cancellable)) {
+        // A newer load replaced this one
+        if (lib != NULL) {
+            free_library(lib);
         }
+        g_clear_error(&error);
+        g_object_unref(cancellable);
         return;
     }
+    g_object_unref(cancellable);
+    g_clear_object(&load_cancellable);
 
-    // Clear existing items
-    GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(song_list)));
-    gtk_list_store_clear(store);
+    if (load_pulse != 0) {
+        g_source_remove(load_pulse);
+        load_pulse = 0;
+        gtk_widget_hide(load_progress);
+    }
 
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;  // Remove newline
-        GtkTreeIter iter;
-        gtk_list_store_append(store, &iter);
-        gtk_list_store_set(store, &iter, 0, line, -1);
+    if (lib == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+            handle_gerror("Failed to open file", error);
+        }
+        g_error_free(error);
+        return;
     }
-    fclose(file);
-}
 
-void save_songs(void) {
-    FILE *file = fopen(fileloc, "w");
-    if (file == NULL) {
-        handle_error("Failed to open file for writing");
+    if (song_model != NULL && load_gen != edit_gen) {
+        // Edited while this was loading; the result may predate the edit
+        free_library(lib);
+        load_songs();
         return;
     }
 
-    GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(song_list)));
-    GtkTreeIter iter;
-    gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter);
+    if (song_model != NULL) {
+        // Reloading: only the rows that changed are touched, so the
+        // selection and scroll position survive
+        if (pif_song_model_update(song_model, lib) == -1) {
+            handle_error("Failed to reload songs");
+        }
+        free_library(lib);
+        return;
+    }
 
-    while (valid) {
-        char *song;
-        gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, 0, &song, -1);
-        fprintf(file, "%s\n", song);
-        g_free(song);
-        valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter);
+    // The model takes the library over and serves rows straight from it.
+    // Attaching is constant time: the view only asks for visible rows.
+    PifSongModel *model = pif_song_model_new(lib);
+    free_library(lib);
+    if (model == NULL || pif_song_model_set_filter(model, gtk_entry_get_text(GTK_ENTRY(search_entry))) == -1) {
+        if (model != NULL) {
+            g_object_unref(model);
+        }
+        handle_error("Failed to load songs");
+        return;
     }
-    fclose(file);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(song_list), GTK_TREE_MODEL(model));
+    song_model = model;
 }
 
-void load_rotation_config(void) {
-    FILE *file = fopen(configloc, "r");
-    if (file == NULL) {
-        if (errno != ENOENT) {
-            handle_error("Failed to open config file");
-        }
+static gboolean pulse_progress(gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+    gtk_progress_bar_pulse(GTK_PROGRESS_BAR(load_progress));
+    return G_SOURCE_CONTINUE;
+}
+
+// Read ~/.pif on a worker thread so the window comes up straight away
+void load_songs(void) {
+    // A reload has to see our own edits, so wait until they are written
+    if (song_model != NULL && pending_edits > 0) {
+        reload_wanted = TRUE;
         return;
     }
+    load_gen = edit_gen;
 
-    char line[256];
-    if (fgets(line, sizeof(line), file)) {
-        sscanf(line, "songs_per_day=%d\n", &songs_per_day);
+    if (load_cancellable != NULL) {
+        g_cancellable_cancel(load_cancellable);
+        g_clear_object(&load_cancellable);
     }
-    if (fgets(line, sizeof(line), file)) {
-        sscanf(line, "last_played=%d\n", &last_played);
+    if (song_model == NULL && load_pulse == 0) {
+        load_pulse = g_timeout_add(100, pulse_progress, NULL);
+        gtk_widget_show(load_progress);
     }
-    fclose(file);
+
+    load_cancellable = g_cancellable_new();
+    GTask *task = g_task_new(NULL, load_cancellable, load_done, g_object_ref(load_cancellable));
+    g_task_run_in_thread(task, load_thread);
+    g_object_unref(task);
 }
 
-void save_rotation_config(void) {
-    FILE *file = fopen(configloc, "w");
-    if (file == NULL) {
-        handle_error("Failed to open config file for writing");
+static gboolean reload_songs(gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+    reload_timeout = 0;
+    load_songs();
+    return G_SOURCE_REMOVE;
+}
+
+static void library_changed(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event,
+                            gpointer data) {
+    (void)monitor;  // Suppress unused parameter warning
+    (void)file;     // Suppress unused parameter warning
+    (void)other;    // Suppress unused parameter warning
+    (void)data;     // Suppress unused parameter warning
+    if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED) {
+        return;
+    }
+
+    // Our own journal appends need no reload: the model already has them
+    struct stat st;
+    if (journal_size != 0 && stat(journal_loc, &st) == 0 && st.st_size == journal_size) {
         return;
     }
 
-    fprintf(file, "songs_per_day=%d\n", songs_per_day);
-    fprintf(file, "last_played=%d\n", last_played);
-    fclose(file);
+    // Writers touch the file several times; reload once they settle
+    if (reload_timeout != 0) {
+        g_source_remove(reload_timeout);
+    }
+    reload_timeout = g_timeout_add(200, reload_songs, NULL);
+}
+
+static gboolean reload_practice(gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+    practice_timeout = 0;
+    if (song_model != NULL) {
+        pif_song_model_practice_changed(song_model);
+        gtk_widget_queue_draw(song_list);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// pif --practiced and pifd record practice sessions in ~/.pif_practice,
+// which the library only reads when asked
+static void practice_changed(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event,
+                             gpointer data) {
+    (void)monitor;  // Suppress unused parameter warning
+    (void)file;     // Suppress unused parameter warning
+    (void)other;    // Suppress unused parameter warning
+    (void)data;     // Suppress unused parameter warning
+    if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED) {
+        return;
+    }
+    if (practice_timeout != 0) {
+        g_source_remove(practice_timeout);
+    }
+    practice_timeout = g_timeout_add(200, reload_practice, NULL);
+}
+
+// Follow edits made by pif or anything else while the window is open
+void watch_files(void) {
+    const struct {
+        const char *path;
+        GCallback changed;
+    } watched[] = {
+        { fileloc, G_CALLBACK(library_changed) },
+        { journal_loc, G_CALLBACK(library_changed) },
+        { practice_loc, G_CALLBACK(practice_changed) },
+    };
+    for (size_t i = 0; i < sizeof(watched) / sizeof(watched[0]); i++) {
+        GFile *file = g_file_new_for_path(watched[i].path);
+        GError *error = NULL;
+        monitors[i] = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, &error);
+        g_object_unref(file);
+        if (monitors[i] == NULL) {
+            g_warning("Cannot watch %s: %s", watched[i].path, error->message);
+            g_error_free(error);
+            continue;
+        }
+        g_signal_connect(monitors[i], "changed", watched[i].changed, NULL);
+    }
+}
+
+static void writer_done(guint records, off_t size, const char *msg, int err) {
+    pending_edits -= records;
+    if (msg != NULL) {
+        errno = err;
+        handle_error(msg);
+    } else if (records > 0) {
+        journal_size = size;
+    }
+
+    if (pending_edits == 0 && reload_wanted) {
+        reload_wanted = FALSE;
+        load_songs();
+    }
+}
+
+// Queue an edit for ~/.pif.journal; the writer thread appends it once
+// the current burst of edits settles
+void save_edit(char op, guint row, const char *line) {
+    pif_writer_journal(op, row, line);
+    pending_edits++;
+    edit_gen++;
+}
+
+// Queue many edits to go out in one write
+void save_edits(const struct pif_journal_record *records, guint count) {
+    pif_writer_journal_all(records, count);
+    pending_edits += count;
+    edit_gen++;
+}
+
+void search_changed(GtkSearchEntry *entry, gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+    if (song_model == NULL) return;  // Applied once loading finishes
+
+    // Keep the selected song selected if it still matches
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(song_list));
+    GtkTreeIter iter;
+    guint selected = G_MAXUINT;
+    if (gtk_tree_selection_get_selected(selection, NULL, &iter)) {
+        selected = pif_song_model_iter_row(song_model, &iter);
+    }
+
+    // Swapping the row set under an attached view would replay it row by
+    // row, so detach while the filter changes
+    gtk_tree_view_set_model(GTK_TREE_VIEW(song_list), NULL);
+    if (pif_song_model_set_filter(song_model, gtk_entry_get_text(GTK_ENTRY(entry))) == -1) {
+        handle_error("Failed to search songs");
+    }
+    gtk_tree_view_set_model(GTK_TREE_VIEW(song_list), GTK_TREE_MODEL(song_model));
+
+    if (selected != G_MAXUINT && pif_song_model_get_iter_for_row(song_model, selected, &iter)) {
+        gtk_tree_selection_select_iter(selection, &iter);
+        GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(song_model), &iter);
+        gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(song_list), path, NULL, FALSE, 0, 0);
+        gtk_tree_path_free(path);
+    }
 }
 
 void show_settings(GtkWidget *widget, gpointer data) {
@@ -142,8 +375,10 @@ void show_settings(GtkWidget *widget, gpointer data) {
     // Songs per day entry
     GtkWidget *songs_label = gtk_label_new("Songs per day:");
     GtkWidget *songs_entry = gtk_entry_new();
+    struct pif_config config;
+    pif_state_read(&state, &config);
     char songs_str[32];
-    snprintf(songs_str, sizeof(songs_str), "%d", songs_per_day);
+    snprintf(songs_str, sizeof(songs_str), "%d", config.songs_per_day);
     gtk_entry_set_text(GTK_ENTRY(songs_entry), songs_str);
     
     gtk_box_pack_start(GTK_BOX(box), songs_label, FALSE, FALSE, 0);
@@ -157,8 +392,7 @@ void show_settings(GtkWidget *widget, gpointer data) {
         char *endptr;
         long new_songs = strtol(songs_text, &endptr, 10);
         if (*endptr == '\0' && new_songs > 0) {
-            songs_per_day = (int)new_songs;
-            save_rotation_config();
+            pif_writer_songs_per_day((int)new_songs);
         } else {
             GtkWidget *error_dialog = gtk_message_dialog_new(NULL,
                 GTK_DIALOG_MODAL,
@@ -176,6 +410,7 @@ void show_settings(GtkWidget *widget, gpointer data) {
 void add_song(GtkWidget *widget, gpointer data) {
     (void)widget;  // Suppress unused parameter warning
     (void)data;    // Suppress unused parameter warning
+    if (song_model == NULL) return;  // Still loading
     const char *song = gtk_entry_get_text(GTK_ENTRY(song_entry));
     if (strlen(song) == 0) return;
 
@@ -191,65 +426,84 @@ void add_song(GtkWidget *widget, gpointer data) {
         return;
     }
 
-    GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(song_list)));
-    GtkTreeIter iter;
-    gtk_list_store_append(store, &iter);
-    gtk_list_store_set(store, &iter, 0, song, -1);
+    if (pif_song_model_append(song_model, song, strlen(song)) == -1) {
+        if (errno != EEXIST) {
+            handle_error("Failed to add song");
+            return;
+        }
+        GtkWidget *dialog = gtk_message_dialog_new(NULL,
+            GTK_DIALOG_MODAL,
+            GTK_MESSAGE_ERROR,
+            GTK_BUTTONS_OK,
+            "A song called %s is already in the list", song);
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+        return;
+    }
 
+    save_edit(PIF_JOURNAL_ADD, 0, song);
     gtk_entry_set_text(GTK_ENTRY(song_entry), "");
-    save_songs();
 }
 
 void remove_song(GtkWidget *widget, gpointer data) {
     (void)widget;  // Suppress unused parameter warning
     (void)data;    // Suppress unused parameter warning
+    if (song_model == NULL) return;  // Still loading
     GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(song_list));
     GtkTreeModel *model;
     GtkTreeIter iter;
 
     if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-        GtkListStore *store = GTK_LIST_STORE(model);
-        gtk_list_store_remove(store, &iter);
-        save_songs();
+        guint row = pif_song_model_iter_row(song_model, &iter);
+        const struct pif_song *song = &pif_song_model_get_library(song_model)->songs[row];
+        char *line = g_strndup(song->line, song->line_len);
+
+        if (pif_song_model_remove(song_model, row) == -1) {
+            handle_error("Failed to remove song");
+        } else {
+            save_edit(PIF_JOURNAL_REMOVE, row, line);
+        }
+        g_free(line);
+    }
+}
+
+// Give the selected song a new frequency, keeping its name
+static void set_selected_frequency(const char *freq) {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(song_list));
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+
+    if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
+        guint row = pif_song_model_iter_row(song_model, &iter);
+        const struct pif_song *song = &pif_song_model_get_library(song_model)->songs[row];
+        char *new_song = g_strdup_printf("%.*s %s", (int)song->name_len, song->line, freq);
+
+        if (pif_song_model_replace(song_model, row, new_song, strlen(new_song)) == -1) {
+            handle_error("Failed to change frequency");
+        } else {
+            save_edit(PIF_JOURNAL_REPLACE, row, new_song);
+            // A new frequency can move the song when sorted by it
+            if (pif_song_model_get_iter_for_row(song_model, row, &iter)) {
+                gtk_tree_selection_select_iter(selection, &iter);
+                GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+                gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(song_list), path, NULL, FALSE, 0, 0);
+                gtk_tree_path_free(path);
+            }
+        }
+        g_free(new_song);
     }
 }
 
 void modify_frequency(GtkWidget *widget, gpointer data) {
     (void)widget;  // Suppress unused parameter warning
     (void)data;    // Suppress unused parameter warning
+    if (song_model == NULL) return;  // Still loading
     const char *freq = gtk_entry_get_text(GTK_ENTRY(freq_entry));
     if (strlen(freq) == 0) return;
 
     // Check if it's "rot" or a number
     if (strcmp(freq, "rot") == 0) {
-        // Handle rotation frequency
-        GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(song_list));
-        GtkTreeModel *model;
-        GtkTreeIter iter;
-
-        if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-            char *song;
-            gtk_tree_model_get(model, &iter, 0, &song, -1);
-            
-            // Find the last space in the song name (if any)
-            char *last_space = strrchr(song, ' ');
-            char new_song[512];
-            
-            if (last_space != NULL) {
-                // If there's a space, truncate at that point and add new frequency
-                size_t base_len = last_space - song;
-                strncpy(new_song, song, base_len);
-                new_song[base_len] = '\0';
-                snprintf(new_song + base_len, sizeof(new_song) - base_len, " rot");
-            } else {
-                // If no space found, just append the frequency
-                snprintf(new_song, sizeof(new_song), "%s rot", song);
-            }
-            
-            gtk_list_store_set(GTK_LIST_STORE(model), &iter, 0, new_song, -1);
-            g_free(song);
-            save_songs();
-        }
+        set_selected_frequency("rot");
     } else {
         // Handle numeric frequency
         char *endptr;
@@ -265,34 +519,151 @@ void modify_frequency(GtkWidget *widget, gpointer data) {
             return;
         }
 
-        GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(song_list));
-        GtkTreeModel *model;
-        GtkTreeIter iter;
-
-        if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-            char *song;
-            gtk_tree_model_get(model, &iter, 0, &song, -1);
-            
-            // Find the last space in the song name (if any)
-            char *last_space = strrchr(song, ' ');
-            char new_song[512];
-            
-            if (last_space != NULL) {
-                // If there's a space, truncate at that point and add new frequency
-                size_t base_len = last_space - song;
-                strncpy(new_song, song, base_len);
-                new_song[base_len] = '\0';
-                snprintf(new_song + base_len, sizeof(new_song) - base_len, " %ld", days);
-            } else {
-                // If no space found, just append the frequency
-                snprintf(new_song, sizeof(new_song), "%s %ld", song, days);
+        char days_str[32];
+        snprintf(days_str, sizeof(days_str), "%ld", days);
+        set_selected_frequency(days_str);
+    }
+}
+
+static void free_paths(gpointer data) {
+    g_slist_free_full(data, g_free);
+}
+
+static void free_import(gpointer data) {
+    pif_import_free(data);
+    g_free(data);
+}
+
+// Read the chosen files and folders off the main loop; folders are walked
+// on a thread per CPU
+static void import_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+    (void)source;       // Suppress unused parameter warning
+    (void)cancellable;  // Suppress unused parameter warning
+
+    struct pif_import *import = g_new(struct pif_import, 1);
+    *import = (struct pif_import)PIF_IMPORT_INIT;
+    for (GSList *l = data; l != NULL; l = l->next) {
+        if (pif_import_read(import, l->data, 0) == -1) {
+            int saved = errno;
+            free_import(import);
+            g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(saved), "%s: %s", (char *)l->data,
+                                    g_strerror(saved));
+            return;
+        }
+    }
+    g_task_return_pointer(task, import, free_import);
+}
+
+static void import_done(GObject *source, GAsyncResult *result, gpointer data) {
+    (void)source;  // Suppress unused parameter warning
+    (void)data;    // Suppress unused parameter warning
+    gtk_widget_set_sensitive(import_item, TRUE);
+
+    GError *error = NULL;
+    struct pif_import *import = g_task_propagate_pointer(G_TASK(result), &error);
+    if (import == NULL) {
+        handle_gerror("Failed to import songs", error);
+        g_error_free(error);
+        return;
+    }
+
+    // Adding rows one by one to an attached view would lay it out for
+    // each, so detach while the songs go in
+    size_t added;
+    gtk_tree_view_set_model(GTK_TREE_VIEW(song_list), NULL);
+    int rc = pif_song_model_add_all(song_model, import->lines, import->lens, import->count, &added);
+    int saved = errno;
+    gtk_tree_view_set_model(GTK_TREE_VIEW(song_list), GTK_TREE_MODEL(song_model));
+
+    // Whatever made it into the list is saved, in a single journal write
+    struct pif_journal_record *records = g_new(struct pif_journal_record, added ? added : 1);
+    for (size_t k = 0; k < added; k++) {
+        records[k] = (struct pif_journal_record){ PIF_JOURNAL_ADD, 0, import->lines[k], import->lens[k] };
+    }
+    if (added > 0) {
+        save_edits(records, (guint)added);
+    }
+    g_free(records);
+
+    if (rc == -1) {
+        errno = saved;
+        handle_error("Failed to import songs");
+    } else {
+        GtkWidget *dialog = gtk_message_dialog_new(NULL,
+            GTK_DIALOG_MODAL,
+            import->skipped_count > 0 ? GTK_MESSAGE_WARNING : GTK_MESSAGE_INFO,
+            GTK_BUTTONS_OK,
+            "Imported %zu songs, skipped %zu already in the list",
+            added,
+            import->count - added);
+
+        // Name the folders that could not be read, a few of them at least
+        if (import->skipped_count > 0) {
+            GString *text = g_string_new(NULL);
+            g_string_printf(text, "%zu folders could not be read:", import->skipped_count);
+            for (size_t k = 0; k < import->skipped_count && k < 10; k++) {
+                g_string_append_printf(text, "\n%s: %s", import->skipped[k].path,
+                                       g_strerror(import->skipped[k].err));
+            }
+            if (import->skipped_count > 10) {
+                g_string_append(text, "\n...");
             }
-            
-            gtk_list_store_set(GTK_LIST_STORE(model), &iter, 0, new_song, -1);
-            g_free(song);
-            save_songs();
+            gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog), "%s", text->str);
+            g_string_free(text, TRUE);
         }
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
     }
+    free_import(import);
+}
+
+#define IMPORT_RESPONSE_FOLDER 1
+
+// Import songs from CSV files and playlists, or from a folder of scores
+// and recordings
+void import_songs(GtkWidget *widget, gpointer data) {
+    (void)widget;  // Suppress unused parameter warning
+    (void)data;    // Suppress unused parameter warning
+    if (song_model == NULL) return;  // Still loading
+
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Import Songs",
+        NULL,
+        GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Folder of Scores...", IMPORT_RESPONSE_FOLDER,
+        "_Import", GTK_RESPONSE_ACCEPT,
+        NULL);
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+    GtkFileFilter *filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "Song lists (CSV, M3U)");
+    gtk_file_filter_add_pattern(filter, "*.[cC][sS][vV]");
+    gtk_file_filter_add_pattern(filter, "*.[tT][xX][tT]");
+    gtk_file_filter_add_pattern(filter, "*.[mM]3[uU]");
+    gtk_file_filter_add_pattern(filter, "*.[mM]3[uU]8");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+    filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "All files");
+    gtk_file_filter_add_pattern(filter, "*");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    if (response == IMPORT_RESPONSE_FOLDER) {
+        gtk_window_set_title(GTK_WINDOW(dialog), "Import a Folder of Scores");
+        gtk_file_chooser_set_action(GTK_FILE_CHOOSER(dialog), GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+        gtk_widget_hide(gtk_dialog_get_widget_for_response(GTK_DIALOG(dialog), IMPORT_RESPONSE_FOLDER));
+        response = gtk_dialog_run(GTK_DIALOG(dialog));
+    }
+    GSList *paths = response == GTK_RESPONSE_ACCEPT ? gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog)) : NULL;
+    gtk_widget_destroy(dialog);
+    if (paths == NULL) {
+        return;
+    }
+
+    gtk_widget_set_sensitive(import_item, FALSE);
+    GTask *task = g_task_new(NULL, NULL, import_done, NULL);
+    g_task_set_task_data(task, paths, free_paths);
+    g_task_run_in_thread(task, import_thread);
+    g_object_unref(task);
 }
 
 void enable_service(GtkWidget *widget, gpointer data) {
@@ -408,9 +779,15 @@ void setup_file(void) {
         exit(1);
     }
     sprintf(configloc, "%s/.pif-config", homedir);
+    stateloc = g_strconcat(homedir, "/" PIF_STATE_NAME, NULL);
 
-    // Load rotation config
-    load_rotation_config();
+    journal_loc = g_strconcat(fileloc, PIF_JOURNAL_SUFFIX, NULL);
+
+    // Where the library looks for the practice log
+    const char *practice_dir = getenv("HOME") != NULL ? getenv("HOME") : homedir;
+    practice_loc = g_strconcat(practice_dir, "/" PRACTICE_LOG_NAME, NULL);
+
+    open_rotation_state();
 
     FILE *file = fopen(fileloc, "r");
     if (file == NULL) {
@@ -444,7 +821,6 @@ static void activate(GtkApplication *app, gpointer user_data) {
     GtkWidget *remove_button;
     GtkWidget *freq_button;
     GtkWidget *scrolled_window;
-    GtkListStore *store;
     GtkCellRenderer *renderer;
     GtkTreeViewColumn *column;
     GtkWidget *menubar;
@@ -472,6 +848,10 @@ static void activate(GtkApplication *app, gpointer user_data) {
     file_menu = gtk_menu_new();
     gtk_menu_item_set_submenu(GTK_MENU_ITEM(file_item), file_menu);
 
+    import_item = gtk_menu_item_new_with_label("Import Songs...");
+    g_signal_connect(import_item, "activate", G_CALLBACK(import_songs), NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), import_item);
+
     GtkWidget *service_item = gtk_menu_item_new_with_label("Enable Notification Service");
     g_signal_connect(service_item, "activate", G_CALLBACK(enable_service), NULL);
     gtk_menu_shell_append(GTK_MENU_SHELL(file_menu), service_item);
@@ -524,6 +904,12 @@ static void activate(GtkApplication *app, gpointer user_data) {
     g_signal_connect(freq_button, "clicked", G_CALLBACK(modify_frequency), NULL);
     gtk_box_pack_start(GTK_BOX(hbox), freq_button, FALSE, FALSE, 0);
 
+    // Search
+    search_entry = gtk_search_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(search_entry), "Search songs");
+    g_signal_connect(search_entry, "search-changed", G_CALLBACK(search_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), search_entry, FALSE, FALSE, 0);
+
     // Song list
     scrolled_window = gtk_scrolled_window_new(NULL, NULL);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window),
@@ -531,41 +917,83 @@ static void activate(GtkApplication *app, gpointer user_data) {
                                  GTK_POLICY_AUTOMATIC);
     gtk_box_pack_start(GTK_BOX(vbox), scrolled_window, TRUE, TRUE, 0);
 
-    store = gtk_list_store_new(1, G_TYPE_STRING);
-    song_list = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
-    g_object_unref(store);
-
-    renderer = gtk_cell_renderer_text_new();
-    column = gtk_tree_view_column_new_with_attributes("Songs",
-                                                    renderer,
-                                                    "text", 0,
-                                                    NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(song_list), column);
+    song_list = gtk_tree_view_new();
+
+    // Fixed-size rows and columns let the view lay out only what is on
+    // screen, however many songs there are
+    static const struct {
+        const char *title;
+        int column;
+        int width;
+    } columns[] = {
+        { "Song", PIF_SONG_COL_NAME, 220 },
+        { "Frequency", PIF_SONG_COL_FREQ, 90 },
+        { "Due", PIF_SONG_COL_DUE, 90 },
+    };
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        renderer = gtk_cell_renderer_text_new();
+        gtk_cell_renderer_text_set_fixed_height_from_font(GTK_CELL_RENDERER_TEXT(renderer), 1);
+        column = gtk_tree_view_column_new_with_attributes(columns[i].title,
+                                                        renderer,
+                                                        "text", columns[i].column,
+                                                        NULL);
+        gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+        gtk_tree_view_column_set_fixed_width(column, columns[i].width);
+        gtk_tree_view_column_set_resizable(column, TRUE);
+        // Clicking a header sorts by it; the model keeps the sort keys
+        gtk_tree_view_column_set_sort_column_id(column, columns[i].column);
+        gtk_tree_view_append_column(GTK_TREE_VIEW(song_list), column);
+    }
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(song_list), TRUE);
     gtk_container_add(GTK_CONTAINER(scrolled_window), song_list);
 
+    // Shown while the library loads in the background
+    load_progress = gtk_progress_bar_new();
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(load_progress), "Loading songs...");
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(load_progress), TRUE);
+    gtk_box_pack_start(GTK_BOX(vbox), load_progress, FALSE, FALSE, 0);
+
     // Remove button
     remove_button = gtk_button_new_with_label("Remove Selected");
     g_signal_connect(remove_button, "clicked", G_CALLBACK(remove_song), NULL);
     gtk_box_pack_start(GTK_BOX(vbox), remove_button, FALSE, FALSE, 0);
 
+    gtk_widget_show_all(window);
+
     // Load existing songs
     load_songs();
-
-    gtk_widget_show_all(window);
+    watch_files();
 }
 
 int main(int argc, char **argv) {
     GtkApplication *app;
     int status;
 
+    pif_trace_init(PIF_TRACE_OFF, 1);  // Only PIF_TRACE, as GApplication owns the options
     setup_file();
+    pif_writer_start(fileloc, &state, getenv("HOME"), writer_done);
 
     app = gtk_application_new("org.pif.gtk", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
+    for (size_t i = 0; i < sizeof(monitors) / sizeof(monitors[0]); i++) {
+        if (monitors[i] != NULL) {
+            g_object_unref(monitors[i]);
+        }
+    }
+    if (song_model != NULL) {
+        g_object_unref(song_model);
+    }
+
+    // Write out anything still queued and fold the journal into ~/.pif
+    pif_writer_stop();
+    pif_state_close(&state);
 
     free(fileloc);
     free(configloc);
+    g_free(stateloc);
+    g_free(journal_loc);
+    g_free(practice_loc);
     return status;
 } 
\ No newline at end of file
@@ -0,0 +1,1190 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "pif-song-model.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// What the model remembers about each song. The costly sort keys are taken
+// once and only dropped when the song is edited, so re-sorting never
+// re-collates a name and the order cannot drift under the view as time
+// passes.
+struct song_cache {
+    gchar *name_key;  // g_utf8_collate_key of the name, NULL until sorted by it
+    int64_t due_key;  // When it falls due, taken when first sorted by it
+    guint8 has_due_key;
+    guint8 checked;  // Last-practice time confirmed this session, or being checked
+};
+
+struct _PifSongModel {
+    GObject parent;
+    struct pif_library lib;
+    guint n_rows;  // Rows the view knows about; lags lib.count mid-update
+    struct song_cache *cache;  // Per song
+    guint cache_size;
+    uint32_t *filter;  // Songs shown in display order, or NULL for all in library order
+    gchar *query;      // NULL if every song is shown
+    gint sort_column;  // GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID for library order
+    GtkSortType sort_order;
+    gint stamp;
+
+    // Due checks read the practice history on a worker thread, in batches
+    // of the rows drawn since the last one
+    gchar *practice_dir;
+    struct practice_source checker;  // Owned by the batch in flight, if any
+    gboolean reopen;                 // The history changed since checker was opened
+    uint32_t *due_queue;             // Song ids waiting for a check
+    guint due_queued;
+    guint due_queue_size;
+    guint due_idle;      // Starts the next batch
+    gboolean checking;   // A batch is in flight
+    guint generation;    // Bumped when the batch in flight can no longer be trusted
+};
+
+// A batch of due checks. The names are copies, so the library can be
+// edited or swapped while the worker reads the history.
+struct due_check {
+    uint32_t *ids;
+    struct practice_query *queries;
+    uint32_t n;
+    guint generation;
+    struct practice_source *source;
+};
+
+static void pif_song_model_tree_model_init(GtkTreeModelIface *iface);
+static void pif_song_model_tree_sortable_init(GtkTreeSortableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(PifSongModel, pif_song_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, pif_song_model_tree_model_init)
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE, pif_song_model_tree_sortable_init))
+
+static void free_cache(struct song_cache *cache, guint size) {
+    for (guint i = 0; i < size; i++) {
+        g_free(cache[i].name_key);
+    }
+    g_free(cache);
+}
+
+static void pif_song_model_finalize(GObject *object) {
+    PifSongModel *model = PIF_SONG_MODEL(object);
+    pif_library_close(&model->lib);
+    free_cache(model->cache, model->cache_size);
+    free(model->filter);
+    g_free(model->query);
+    if (model->due_idle != 0) {
+        g_source_remove(model->due_idle);
+    }
+    free(model->due_queue);
+    practice_source_close(&model->checker);
+    g_free(model->practice_dir);
+    G_OBJECT_CLASS(pif_song_model_parent_class)->finalize(object);
+}
+
+static void pif_song_model_class_init(PifSongModelClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = pif_song_model_finalize;
+}
+
+static void pif_song_model_init(PifSongModel *model) {
+    model->stamp = g_random_int();
+    model->sort_column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+    model->sort_order = GTK_SORT_ASCENDING;
+}
+
+static gboolean set_iter(PifSongModel *model, GtkTreeIter *iter, guint row) {
+    if (row >= model->n_rows) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    iter->stamp = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(row);
+    return TRUE;
+}
+
+// Library row shown at a view row
+static guint lib_row(PifSongModel *model, guint row) {
+    return model->filter != NULL ? model->filter[row] : row;
+}
+
+static const char *name_key(PifSongModel *model, guint row) {
+    struct song_cache *c = &model->cache[row];
+    if (c->name_key == NULL) {
+        const struct pif_song *song = &model->lib.songs[row];
+        c->name_key = g_utf8_collate_key(song->line, song->name_len);
+    }
+    return c->name_key;
+}
+
+// Rotation songs after every frequency song, songs without a frequency last
+static int64_t due_key(PifSongModel *model, guint row) {
+    struct song_cache *c = &model->cache[row];
+    if (!c->has_due_key) {
+        const struct pif_song *song = &model->lib.songs[row];
+        c->due_key = song->freq > 0 ? pif_song_due_time(song) : song->freq == PIF_FREQ_ROT ? INT64_MAX - 1 : INT64_MAX;
+        c->has_due_key = 1;
+    }
+    return c->due_key;
+}
+
+// Rotation first, then by days, songs without a frequency last
+static int32_t freq_key(const struct pif_song *song) {
+    return song->freq > 0 ? song->freq : song->freq == PIF_FREQ_ROT ? 0 : INT32_MAX;
+}
+
+// Display order of two library rows, ties going by library order
+static int compare(PifSongModel *model, guint a, guint b) {
+    int c = 0;
+    switch (model->sort_column) {
+    case PIF_SONG_COL_NAME:
+        c = strcmp(name_key(model, a), name_key(model, b));
+        break;
+    case PIF_SONG_COL_FREQ: {
+        int32_t x = freq_key(&model->lib.songs[a]), y = freq_key(&model->lib.songs[b]);
+        c = (x > y) - (x < y);
+        break;
+    }
+    case PIF_SONG_COL_DUE: {
+        int64_t x = due_key(model, a), y = due_key(model, b);
+        c = (x > y) - (x < y);
+        break;
+    }
+    }
+    if (c != 0) {
+        return model->sort_order == GTK_SORT_DESCENDING ? -c : c;
+    }
+    return (a > b) - (a < b);
+}
+
+static int compare_rows(const void *a, const void *b, void *data) {
+    return compare(data, *(const uint32_t *)a, *(const uint32_t *)b);
+}
+
+static int sorted(PifSongModel *model) {
+    return model->sort_column >= 0;
+}
+
+// View row showing a library row, or where it would go if filtered out
+static gboolean view_row(PifSongModel *model, guint row, guint *pos) {
+    if (model->filter == NULL) {
+        *pos = row;
+        return TRUE;
+    }
+    guint lo = 0, hi = model->n_rows;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (sorted(model) ? compare(model, model->filter[mid], row) < 0 : model->filter[mid] < row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return lo < model->n_rows && model->filter[lo] == row;
+}
+
+static GtkTreeModelFlags get_flags(GtkTreeModel *tree_model) {
+    (void)tree_model;  // Suppress unused parameter warning
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint get_n_columns(GtkTreeModel *tree_model) {
+    (void)tree_model;  // Suppress unused parameter warning
+    return PIF_SONG_N_COLUMNS;
+}
+
+static GType get_column_type(GtkTreeModel *tree_model, gint column) {
+    (void)tree_model;  // Suppress unused parameter warning
+    return column >= 0 && column < PIF_SONG_N_COLUMNS ? G_TYPE_STRING : G_TYPE_INVALID;
+}
+
+static gboolean get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path) {
+    if (gtk_tree_path_get_depth(path) != 1) {
+        return FALSE;
+    }
+    return set_iter(PIF_SONG_MODEL(tree_model), iter, (guint)gtk_tree_path_get_indices(path)[0]);
+}
+
+static GtkTreePath *get_path(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    (void)tree_model;  // Suppress unused parameter warning
+    return gtk_tree_path_new_from_indices((gint)GPOINTER_TO_UINT(iter->user_data), -1);
+}
+
+static gboolean start_checks(gpointer data);
+
+// Only ask the disk about songs the cache cannot already rule out, and
+// only once per row. The row shows its cached time until the answer
+// comes back from the worker and the view is told it changed.
+static void check_due(PifSongModel *model, guint row, time_t now) {
+    struct pif_song *song = &model->lib.songs[row];
+    if (row >= model->cache_size || model->cache[row].checked || !pif_library_is_due(song, now)) {
+        return;
+    }
+    if (model->due_queued == model->due_queue_size) {
+        guint size = model->due_queue_size ? model->due_queue_size * 2 : 64;
+        uint32_t *queue = realloc(model->due_queue, size * sizeof(*queue));
+        if (queue == NULL) {
+            return;
+        }
+        model->due_queue = queue;
+        model->due_queue_size = size;
+    }
+    model->due_queue[model->due_queued++] = song->id;
+    model->cache[row].checked = 1;
+    if (!model->checking && model->due_idle == 0) {
+        model->due_idle = g_idle_add(start_checks, model);
+    }
+}
+
+static gchar *due_text(PifSongModel *model, guint row) {
+    const struct pif_song *song = &model->lib.songs[row];
+    if (song->freq == PIF_FREQ_ROT) {
+        return g_strdup("Rotation");
+    }
+    if (song->freq <= 0) {
+        return g_strdup("");
+    }
+
+    time_t now = time(NULL);
+    check_due(model, row, now);
+    if (pif_library_is_due(song, now)) {
+        return g_strdup("Due");
+    }
+    int64_t days = song->freq - (now - song->last_practice) / PIF_SECONDS_PER_DAY;
+    return g_strdup_printf(days == 1 ? "In %lld day" : "In %lld days", (long long)days);
+}
+
+static void get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value) {
+    PifSongModel *model = PIF_SONG_MODEL(tree_model);
+    guint row = GPOINTER_TO_UINT(iter->user_data);
+    g_value_init(value, G_TYPE_STRING);
+    if (iter->stamp != model->stamp || row >= model->n_rows) {
+        return;
+    }
+    row = lib_row(model, row);
+    if (row >= model->lib.count) {
+        return;  // Mid-update, the view may still ask about rows now gone
+    }
+
+    const struct pif_song *song = &model->lib.songs[row];
+    size_t len;
+    const char *text;
+    switch (column) {
+    case PIF_SONG_COL_NAME:
+        g_value_take_string(value, g_strndup(song->line, song->name_len));
+        break;
+    case PIF_SONG_COL_FREQ:
+        text = pif_song_freq_text(song, &len);
+        g_value_take_string(value, g_strndup(text, len));
+        break;
+    case PIF_SONG_COL_DUE:
+        g_value_take_string(value, due_text(model, row));
+        break;
+    }
+}
+
+static gboolean iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return set_iter(PIF_SONG_MODEL(tree_model), iter, GPOINTER_TO_UINT(iter->user_data) + 1);
+}
+
+static gboolean iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    guint row = GPOINTER_TO_UINT(iter->user_data);
+    if (row == 0) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    return set_iter(PIF_SONG_MODEL(tree_model), iter, row - 1);
+}
+
+static gboolean iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    if (parent != NULL) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    return set_iter(PIF_SONG_MODEL(tree_model), iter, 0);
+}
+
+static gboolean iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    (void)tree_model;  // Suppress unused parameter warning
+    (void)iter;        // Suppress unused parameter warning
+    return FALSE;
+}
+
+static gint iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return iter == NULL ? (gint)PIF_SONG_MODEL(tree_model)->n_rows : 0;
+}
+
+static gboolean iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {
+    if (parent != NULL || n < 0) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    return set_iter(PIF_SONG_MODEL(tree_model), iter, (guint)n);
+}
+
+static gboolean iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child) {
+    (void)tree_model;  // Suppress unused parameter warning
+    (void)child;       // Suppress unused parameter warning
+    iter->stamp = 0;
+    return FALSE;
+}
+
+static void pif_song_model_tree_model_init(GtkTreeModelIface *iface) {
+    iface->get_flags = get_flags;
+    iface->get_n_columns = get_n_columns;
+    iface->get_column_type = get_column_type;
+    iface->get_iter = get_iter;
+    iface->get_path = get_path;
+    iface->get_value = get_value;
+    iface->iter_next = iter_next;
+    iface->iter_previous = iter_previous;
+    iface->iter_children = iter_children;
+    iface->iter_has_child = iter_has_child;
+    iface->iter_n_children = iter_n_children;
+    iface->iter_nth_child = iter_nth_child;
+    iface->iter_parent = iter_parent;
+}
+
+static int reserve_cache(PifSongModel *model, guint count) {
+    if (count <= model->cache_size) {
+        return 0;
+    }
+    guint size = model->cache_size ? model->cache_size : 64;
+    while (size < count) {
+        size *= 2;
+    }
+    struct song_cache *cache = g_try_realloc_n(model->cache, size, sizeof(*cache));
+    if (cache == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(cache + model->cache_size, 0, (size - model->cache_size) * sizeof(*cache));
+    model->cache = cache;
+    model->cache_size = size;
+    return 0;
+}
+
+// The song was edited: its sort keys and practice time have to be taken again
+static void forget_song(PifSongModel *model, guint row) {
+    g_free(model->cache[row].name_key);
+    memset(&model->cache[row], 0, sizeof(model->cache[row]));
+}
+
+PifSongModel *pif_song_model_new(struct pif_library *lib) {
+    PifSongModel *model = g_object_new(PIF_TYPE_SONG_MODEL, NULL);
+    model->lib = *lib;
+    model->n_rows = lib->count;
+    memset(lib, 0, sizeof(*lib));
+    model->practice_dir = g_strdup(model->lib.practice.dir);
+    practice_source_init(&model->checker, model->practice_dir);
+    if (reserve_cache(model, model->lib.count) == -1) {
+        g_object_unref(model);
+        return NULL;
+    }
+    return model;
+}
+
+struct pif_library *pif_song_model_get_library(PifSongModel *model) {
+    return &model->lib;
+}
+
+guint pif_song_model_iter_row(PifSongModel *model, GtkTreeIter *iter) {
+    g_return_val_if_fail(iter->stamp == model->stamp, G_MAXUINT);
+    return lib_row(model, GPOINTER_TO_UINT(iter->user_data));
+}
+
+gboolean pif_song_model_get_iter_for_row(PifSongModel *model, guint row, GtkTreeIter *iter) {
+    guint pos;
+    if (!view_row(model, row, &pos)) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    return set_iter(model, iter, pos);
+}
+
+static void emit_inserted(PifSongModel *model, guint pos) {
+    GtkTreeIter iter;
+    set_iter(model, &iter, pos);
+    GtkTreePath *path = gtk_tree_path_new_from_indices((gint)pos, -1);
+    gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+    gtk_tree_path_free(path);
+}
+
+static void emit_deleted(PifSongModel *model, guint pos) {
+    GtkTreePath *path = gtk_tree_path_new_from_indices((gint)pos, -1);
+    gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+    gtk_tree_path_free(path);
+}
+
+static void emit_changed(PifSongModel *model, guint pos) {
+    GtkTreeIter iter;
+    set_iter(model, &iter, pos);
+    GtkTreePath *path = gtk_tree_path_new_from_indices((gint)pos, -1);
+    gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, &iter);
+    gtk_tree_path_free(path);
+}
+
+static void free_check(gpointer data) {
+    struct due_check *check = data;
+    for (uint32_t k = 0; k < check->n; k++) {
+        g_free((gchar *)check->queries[k].name);
+    }
+    g_free(check->queries);
+    free(check->ids);
+    g_free(check);
+}
+
+// Row of a song id, if it is still there and still called by the name
+// in query when one is given
+static gboolean row_of_check(PifSongModel *model, uint32_t id, const struct practice_query *query, guint *row) {
+    if (id >= model->lib.next_id || model->lib.row_of[id] == UINT32_MAX) {
+        return FALSE;
+    }
+    *row = model->lib.row_of[id];
+    const struct pif_song *song = &model->lib.songs[*row];
+    return query == NULL ||
+           (song->name_len == query->name_len && memcmp(song->line, query->name, query->name_len) == 0);
+}
+
+// Let rows whose check never happened be queued again when next drawn
+static void unqueue(PifSongModel *model, const uint32_t *ids, guint n) {
+    for (guint k = 0; k < n; k++) {
+        guint row;
+        if (row_of_check(model, ids[k], NULL, &row)) {
+            model->cache[row].checked = 0;
+        }
+    }
+}
+
+static void check_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancellable) {
+    (void)source;       // Suppress unused parameter warning
+    (void)cancellable;  // Suppress unused parameter warning
+    struct due_check *check = data;
+    g_task_return_boolean(task, practice_source_lookup(check->source, check->queries, check->n) == 0);
+}
+
+static void check_done(GObject *source, GAsyncResult *result, gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+    PifSongModel *model = PIF_SONG_MODEL(source);
+    struct due_check *check = g_task_get_task_data(G_TASK(result));
+    gboolean ok = g_task_propagate_boolean(G_TASK(result), NULL);
+    model->checking = FALSE;
+
+    // After a reload or a change to the history these rows were already
+    // let go, and are queued again as they are drawn
+    if (check->generation == model->generation) {
+        for (uint32_t k = 0; k < check->n; k++) {
+            guint row, pos;
+            if (!row_of_check(model, check->ids[k], &check->queries[k], &row)) {
+                continue;
+            }
+            if (!ok) {
+                model->cache[row].checked = 0;
+                continue;
+            }
+            pif_library_set_practiced(&model->lib, row, check->queries[k].when);
+            if (view_row(model, row, &pos)) {
+                emit_changed(model, pos);
+            }
+        }
+    }
+    if (model->due_queued > 0 && model->due_idle == 0) {
+        model->due_idle = g_idle_add(start_checks, model);
+    }
+}
+
+// Hand the rows queued so far to a worker
+static gboolean start_checks(gpointer data) {
+    PifSongModel *model = data;
+    model->due_idle = 0;
+    if (model->checking || model->due_queued == 0) {
+        return G_SOURCE_REMOVE;
+    }
+    uint32_t *ids = model->due_queue;
+    guint n = model->due_queued;
+    model->due_queue = NULL;
+    model->due_queued = 0;
+    model->due_queue_size = 0;
+
+    struct due_check *check = g_try_new0(struct due_check, 1);
+    struct practice_query *queries = g_try_new0(struct practice_query, n);
+    if (check == NULL || queries == NULL) {
+        g_free(check);
+        g_free(queries);
+        unqueue(model, ids, n);
+        free(ids);
+        return G_SOURCE_REMOVE;
+    }
+    check->ids = ids;
+    check->queries = queries;
+    check->generation = model->generation;
+    check->source = &model->checker;
+    for (guint k = 0; k < n; k++) {
+        guint row;
+        if (row_of_check(model, ids[k], NULL, &row)) {
+            const struct pif_song *song = &model->lib.songs[row];
+            ids[check->n] = ids[k];
+            queries[check->n] = (struct practice_query){ g_strndup(song->line, song->name_len), song->name_len, 0 };
+            check->n++;
+        }
+    }
+    if (check->n == 0) {
+        free_check(check);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (model->reopen) {
+        practice_source_close(&model->checker);
+        practice_source_init(&model->checker, model->practice_dir);
+        model->reopen = FALSE;
+    }
+    model->checking = TRUE;
+    GTask *task = g_task_new(model, NULL, check_done, NULL);
+    g_task_set_task_data(task, check, free_check);
+    g_task_run_in_thread(task, check_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+static int matches(PifSongModel *model, guint row) {
+    return model->query == NULL || pif_song_matches(&model->lib.songs[row], model->query, strlen(model->query));
+}
+
+// Make room in the filter for one more row
+static int reserve_filter(PifSongModel *model) {
+    uint32_t *filter = realloc(model->filter, (model->n_rows + 1) * sizeof(*filter));
+    if (filter == NULL) {
+        return -1;
+    }
+    model->filter = filter;
+    return 0;
+}
+
+static void filter_put(PifSongModel *model, guint pos, guint row) {
+    memmove(&model->filter[pos + 1], &model->filter[pos], (model->n_rows - pos) * sizeof(*model->filter));
+    model->filter[pos] = row;
+    model->n_rows++;
+}
+
+static void filter_take(PifSongModel *model, guint pos) {
+    memmove(&model->filter[pos], &model->filter[pos + 1], (model->n_rows - pos - 1) * sizeof(*model->filter));
+    model->n_rows--;
+}
+
+// Show a library row that was filtered out
+static void filter_insert(PifSongModel *model, guint row) {
+    guint pos;
+    view_row(model, row, &pos);
+    filter_put(model, pos, row);
+    emit_inserted(model, pos);
+}
+
+static void filter_delete(PifSongModel *model, guint pos) {
+    filter_take(model, pos);
+    emit_deleted(model, pos);
+}
+
+int pif_song_model_append(PifSongModel *model, const char *line, size_t len) {
+    if (reserve_cache(model, model->lib.count + 1) == -1 ||
+        (model->filter != NULL && reserve_filter(model) == -1) ||
+        pif_library_add(&model->lib, line, len) == -1) {
+        return -1;
+    }
+
+    guint row = model->lib.count - 1;
+    forget_song(model, row);
+    if (model->filter == NULL) {
+        model->n_rows++;
+        emit_inserted(model, row);
+    } else if (matches(model, row)) {
+        filter_insert(model, row);
+    }
+    return 0;
+}
+
+int pif_song_model_remove(PifSongModel *model, guint row) {
+    // Found while the song and its keys are still there
+    guint pos;
+    gboolean shown = view_row(model, row, &pos);
+    if (pif_library_remove(&model->lib, row) == -1) {
+        return -1;
+    }
+    g_free(model->cache[row].name_key);
+    memmove(model->cache + row, model->cache + row + 1, (model->lib.count - row) * sizeof(*model->cache));
+    memset(&model->cache[model->lib.count], 0, sizeof(*model->cache));
+
+    // Rows after this one move up, so outstanding iters are stale
+    model->stamp++;
+    if (model->filter == NULL) {
+        model->n_rows--;
+        emit_deleted(model, row);
+        return 0;
+    }
+
+    for (guint k = 0; k < model->n_rows; k++) {
+        if (model->filter[k] > row) {
+            model->filter[k]--;
+        }
+    }
+    if (shown) {
+        filter_delete(model, pos);
+    }
+    return 0;
+}
+
+int pif_song_model_replace(PifSongModel *model, guint row, const char *line, size_t len) {
+    // Found while the song and its keys are still the old ones
+    guint pos;
+    gboolean shown = view_row(model, row, &pos);
+    if ((model->filter != NULL && reserve_filter(model) == -1) ||
+        pif_library_replace(&model->lib, row, line, len) == -1) {
+        return -1;
+    }
+    forget_song(model, row);
+    if (model->filter == NULL) {
+        emit_changed(model, pos);
+        return 0;
+    }
+    if (shown) {
+        filter_take(model, pos);
+    }
+    guint to;
+    view_row(model, row, &to);
+    if (shown && to == pos && matches(model, row)) {
+        filter_put(model, pos, row);
+        emit_changed(model, pos);
+        return 0;
+    }
+    if (shown) {
+        emit_deleted(model, pos);
+    }
+    if (matches(model, row)) {
+        filter_insert(model, row);
+    }
+    return 0;
+}
+
+// Every shown song in display order, or NULL for all in library order
+static int make_order(PifSongModel *model, const struct pif_library *lib, const char *query, uint32_t **rows,
+                      uint32_t *count) {
+    *rows = NULL;
+    *count = lib->count;
+    if (query != NULL && query[0] != '\0') {
+        if (pif_library_search(lib, query, strlen(query), rows, count) == -1) {
+            return -1;
+        }
+    } else if (sorted(model)) {
+        if ((*rows = malloc((lib->count ? lib->count : 1) * sizeof(**rows))) == NULL) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < lib->count; i++) {
+            (*rows)[i] = i;
+        }
+    }
+    return 0;
+}
+
+// Sort rows by the model's song cache and sort column
+static void sort_rows(PifSongModel *model, uint32_t *rows, uint32_t count) {
+    if (rows != NULL && sorted(model)) {
+        qsort_r(rows, count, sizeof(*rows), compare_rows, model);
+    }
+}
+
+int pif_song_model_set_filter(PifSongModel *model, const char *query) {
+    uint32_t *filter;
+    uint32_t count;
+    if (make_order(model, &model->lib, query, &filter, &count) == -1) {
+        return -1;
+    }
+    sort_rows(model, filter, count);
+
+    free(model->filter);
+    g_free(model->query);
+    model->filter = filter;
+    model->query = query[0] != '\0' ? g_strdup(query) : NULL;
+    model->n_rows = count;
+    model->stamp++;
+    return 0;
+}
+
+int pif_song_model_add_all(PifSongModel *model, const char **lines, uint32_t *lens, size_t count, size_t *added) {
+    *added = 0;
+    if (count > UINT32_MAX - model->lib.count) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (reserve_cache(model, model->lib.count + (guint)count) == -1) {
+        return -1;
+    }
+    int rc = 0;
+    for (size_t k = 0; k < count; k++) {
+        if (pif_library_add(&model->lib, lines[k], lens[k]) == 0) {
+            forget_song(model, model->lib.count - 1);
+            lines[*added] = lines[k];
+            lens[*added] = lens[k];
+            (*added)++;
+        } else if (errno != EEXIST) {
+            rc = -1;
+            break;
+        }
+    }
+
+    // No view is watching, so the shown rows are simply taken again
+    int saved = errno;
+    uint32_t *filter;
+    uint32_t shown;
+    if (make_order(model, &model->lib, model->query, &filter, &shown) == -1) {
+        // Show the library unfiltered rather than lose track of rows
+        saved = errno;
+        rc = -1;
+        g_clear_pointer(&model->query, g_free);
+        model->sort_column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+        filter = NULL;
+        shown = model->lib.count;
+    }
+    sort_rows(model, filter, shown);
+    free(model->filter);
+    model->filter = filter;
+    model->n_rows = shown;
+    model->stamp++;
+    errno = saved;
+    return rc;
+}
+
+// Tell the view where each shown row went, given each library row's old
+// position
+static void emit_reordered(PifSongModel *model, const guint *old_pos) {
+    gint *new_order = g_try_new(gint, model->n_rows ? model->n_rows : 1);
+    if (new_order == NULL || model->n_rows == 0) {
+        g_free(new_order);
+        return;
+    }
+    for (guint k = 0; k < model->n_rows; k++) {
+        new_order[k] = (gint)old_pos[lib_row(model, k)];
+    }
+    GtkTreePath *path = gtk_tree_path_new();
+    gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, new_order);
+    gtk_tree_path_free(path);
+    g_free(new_order);
+}
+
+void pif_song_model_practice_changed(PifSongModel *model) {
+    // As pifd does: cached times only go stale in the "due" direction, so
+    // reopening the history is enough for the due checks to see it
+    struct practice_source *practice = &model->lib.practice;
+    const char *dir = practice->dir;
+    struct pif_arena *arena = practice->arena;
+    practice_source_close(practice);
+    practice_source_init(practice, dir);
+    practice->arena = arena;
+    model->reopen = TRUE;
+    model->generation++;
+    model->due_queued = 0;
+
+    // Due keys order the view when sorted by them, so they can only be
+    // dropped along with that order
+    gboolean resort = model->filter != NULL && model->sort_column == PIF_SONG_COL_DUE;
+    guint *old_pos = resort ? g_try_new(guint, model->lib.count ? model->lib.count : 1) : NULL;
+    if (resort && old_pos == NULL) {
+        for (guint i = 0; i < model->lib.count; i++) {
+            model->cache[i].checked = 0;
+        }
+        return;  // Keep the old order and its keys
+    }
+    for (guint i = 0; i < model->lib.count; i++) {
+        model->cache[i].checked = 0;
+        model->cache[i].has_due_key = 0;
+    }
+    if (!resort) {
+        return;
+    }
+    for (guint k = 0; k < model->n_rows; k++) {
+        old_pos[model->filter[k]] = k;
+    }
+    sort_rows(model, model->filter, model->n_rows);
+    emit_reordered(model, old_pos);
+    g_free(old_pos);
+}
+
+static int same_song(const struct pif_song *a, const struct pif_song *b) {
+    return a->line_len == b->line_len && memcmp(a->line, b->line, a->line_len) == 0;
+}
+
+#define NO_ROW UINT32_MAX
+
+static guint hash_line(const struct pif_song *song) {
+    guint h = 2166136261u;
+    for (uint32_t i = 0; i < song->line_len; i++) {
+        h = (h ^ (unsigned char)song->line[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Pair up the rows of two libraries by their lines: old_of[j] is the old
+// row of new row j, or NO_ROW. Only the longest run of pairs in the same
+// order in both is kept, so the rest reads as rows deleted, inserted or
+// changed between them however far apart the edits are.
+static int match_rows(const struct pif_library *old, const struct pif_library *lib, uint32_t *old_of) {
+    guint capacity = 16;
+    while (capacity < 2 * old->count) {
+        capacity *= 2;
+    }
+    uint32_t *slots = g_try_new(uint32_t, 2 * capacity);  // Some old row with a line, plus one
+    uint32_t *next = g_try_new(uint32_t, old->count ? old->count : 1);  // Next old row with the same line
+    uint32_t *tails = g_try_new(uint32_t, lib->count ? lib->count : 1);
+    uint32_t *prev = g_try_new(uint32_t, lib->count ? lib->count : 1);
+    if (slots == NULL || next == NULL || tails == NULL || prev == NULL) {
+        g_free(slots);
+        g_free(next);
+        g_free(tails);
+        g_free(prev);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Repeated lines chain from the first, so they pair up in order
+    uint32_t *heads = slots + capacity;  // First unpaired old row with the line
+    memset(slots, 0, capacity * sizeof(*slots));
+    guint mask = capacity - 1;
+    for (uint32_t i = old->count; i-- > 0;) {
+        guint k = hash_line(&old->songs[i]) & mask;
+        while (slots[k] != 0 && !same_song(&old->songs[slots[k] - 1], &old->songs[i])) {
+            k = (k + 1) & mask;
+        }
+        next[i] = slots[k] != 0 ? heads[k] : NO_ROW;
+        slots[k] = i + 1;
+        heads[k] = i;
+    }
+    for (uint32_t j = 0; j < lib->count; j++) {
+        old_of[j] = NO_ROW;
+        guint k = hash_line(&lib->songs[j]) & mask;
+        while (slots[k] != 0 && !same_song(&old->songs[slots[k] - 1], &lib->songs[j])) {
+            k = (k + 1) & mask;
+        }
+        if (slots[k] != 0 && heads[k] != NO_ROW) {
+            old_of[j] = heads[k];
+            heads[k] = next[heads[k]];
+        }
+    }
+
+    // Longest run of pairs increasing in both, by patience sorting:
+    // tails[l] is the new row ending the best run of length l + 1
+    guint runs = 0;
+    for (uint32_t j = 0; j < lib->count; j++) {
+        if (old_of[j] == NO_ROW) {
+            continue;
+        }
+        guint lo = 0, hi = runs;
+        while (lo < hi) {
+            guint mid = lo + (hi - lo) / 2;
+            if (old_of[tails[mid]] < old_of[j]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        prev[j] = lo > 0 ? tails[lo - 1] : NO_ROW;
+        tails[lo] = j;
+        if (lo == runs) {
+            runs++;
+        }
+    }
+
+    // Unpair everything off that run
+    uint32_t keep = runs > 0 ? tails[runs - 1] : NO_ROW;
+    for (uint32_t j = lib->count; j-- > 0;) {
+        if (j == keep) {
+            keep = prev[j];
+        } else {
+            old_of[j] = NO_ROW;
+        }
+    }
+    g_free(slots);
+    g_free(next);
+    g_free(tails);
+    g_free(prev);
+    return 0;
+}
+
+// Tell the view that at pos, old rows gave way to new ones: as many as
+// both have changed in place, and the rest were deleted or inserted
+static void replay_gap(PifSongModel *model, guint pos, guint old, guint new) {
+    guint both = MIN(old, new);
+    for (guint k = 0; k < both; k++) {
+        emit_changed(model, pos + k);
+    }
+    for (guint k = new; k < old; k++) {
+        model->n_rows--;
+        emit_deleted(model, pos + both);
+    }
+    for (guint k = old; k < new; k++) {
+        model->n_rows++;
+        emit_inserted(model, pos + k);
+    }
+}
+
+// Hand the sort keys of songs whose line is unchanged over to their new
+// rows. Their practice times are confirmed again, the log may have moved on.
+static struct song_cache *carry_cache(PifSongModel *model, const struct pif_library *lib, const uint32_t *old_of) {
+    struct song_cache *cache = g_try_malloc0_n(lib->count ? lib->count : 1, sizeof(*cache));
+    if (cache == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (uint32_t j = 0; j < lib->count; j++) {
+        if (old_of[j] != NO_ROW) {
+            cache[j] = model->cache[old_of[j]];
+            cache[j].checked = 0;
+            model->cache[old_of[j]].name_key = NULL;
+        }
+    }
+    return cache;
+}
+
+// With a filter or sort order in place, songs whose line is unchanged
+// stay shown in the same order, since they match and sort as they did.
+// The view hears about the others being deleted and inserted, and gets
+// one reorder should the kept songs have moved after all.
+static int update_filtered(PifSongModel *model, struct pif_library *lib, const uint32_t *old_of) {
+    uint32_t *order;
+    uint32_t count;
+    if (make_order(model, lib, model->query, &order, &count) == -1) {
+        return -1;
+    }
+    guint size = MAX(model->lib.count, lib->count);
+    guint *at = g_try_new(guint, size ? size : 1);
+    uint32_t *filter = g_try_new(uint32_t, MAX(model->n_rows, count) ? MAX(model->n_rows, count) : 1);
+    struct song_cache *cache = at != NULL && filter != NULL ? carry_cache(model, lib, old_of) : NULL;
+    if (cache == NULL) {
+        free(order);
+        g_free(at);
+        g_free(filter);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Shown songs by their new rows, NO_ROW for those gone
+    for (uint32_t i = 0; i < model->lib.count; i++) {
+        at[i] = NO_ROW;
+    }
+    for (uint32_t j = 0; j < lib->count; j++) {
+        if (old_of[j] != NO_ROW) {
+            at[old_of[j]] = j;
+        }
+    }
+    for (guint k = 0; k < model->n_rows; k++) {
+        filter[k] = at[model->filter[k]];
+    }
+
+    pif_library_close(&model->lib);
+    model->lib = *lib;
+    memset(lib, 0, sizeof(*lib));
+    free_cache(model->cache, model->cache_size);
+    model->cache = cache;
+    model->cache_size = model->lib.count ? model->lib.count : 1;
+    sort_rows(model, order, count);
+    free(model->filter);
+    model->filter = filter;
+    model->stamp++;
+
+    for (guint k = model->n_rows; k-- > 0;) {
+        if (filter[k] == NO_ROW) {
+            filter_delete(model, k);
+        }
+    }
+
+    guint kept = 0, moved = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        if (old_of[order[k]] != NO_ROW) {
+            moved |= filter[kept] != order[k];
+            kept++;
+        }
+    }
+    if (moved) {
+        for (guint k = 0; k < kept; k++) {
+            at[filter[k]] = k;
+        }
+        kept = 0;
+        for (uint32_t k = 0; k < count; k++) {
+            if (old_of[order[k]] != NO_ROW) {
+                filter[kept++] = order[k];
+            }
+        }
+        emit_reordered(model, at);
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        if (old_of[order[k]] == NO_ROW) {
+            filter_put(model, k, order[k]);
+            emit_inserted(model, k);
+        }
+    }
+    free(order);
+    g_free(at);
+    return 0;
+}
+
+// Without a filter or sort order, rows whose line is unchanged stay put
+// and the gaps between them are replayed as deletions, insertions and
+// changes so the view keeps its selection and scroll position
+static int update_all(PifSongModel *model, struct pif_library *lib, const uint32_t *old_of) {
+    struct song_cache *cache = carry_cache(model, lib, old_of);
+    if (cache == NULL) {
+        return -1;
+    }
+    uint32_t old_count = model->lib.count;
+    pif_library_close(&model->lib);
+    model->lib = *lib;
+    memset(lib, 0, sizeof(*lib));
+    free_cache(model->cache, model->cache_size);
+    model->cache = cache;
+    model->cache_size = model->lib.count ? model->lib.count : 1;
+    model->stamp++;
+
+    guint pos = 0;
+    uint32_t old_next = 0, new_next = 0;
+    for (;;) {
+        uint32_t j = new_next;
+        while (j < model->lib.count && old_of[j] == NO_ROW) {
+            j++;
+        }
+        uint32_t i = j < model->lib.count ? old_of[j] : old_count;
+        replay_gap(model, pos, i - old_next, j - new_next);
+        pos += j - new_next;
+        if (j == model->lib.count) {
+            break;
+        }
+        pos++;
+        old_next = i + 1;
+        new_next = j + 1;
+    }
+    return 0;
+}
+
+int pif_song_model_update(PifSongModel *model, struct pif_library *lib) {
+    uint32_t *old_of = g_try_new(uint32_t, lib->count ? lib->count : 1);
+    if (old_of == NULL || match_rows(&model->lib, lib, old_of) == -1) {
+        g_free(old_of);
+        errno = ENOMEM;
+        return -1;
+    }
+    int ret = model->filter != NULL ? update_filtered(model, lib, old_of) : update_all(model, lib, old_of);
+    if (ret == 0) {
+        model->generation++;  // Ids in the batch in flight were the old library's
+        model->due_queued = 0;
+    }
+    g_free(old_of);
+    return ret;
+}
+
+static gboolean get_sort_column_id(GtkTreeSortable *sortable, gint *sort_column_id, GtkSortType *order) {
+    PifSongModel *model = PIF_SONG_MODEL(sortable);
+    if (sort_column_id != NULL) {
+        *sort_column_id = model->sort_column;
+    }
+    if (order != NULL) {
+        *order = model->sort_order;
+    }
+    return sorted(model);
+}
+
+// Re-sort the shown rows and tell the view where each one went. Only the
+// first sort by a column computes its keys; later ones compare cached keys.
+static void set_sort_column_id(GtkTreeSortable *sortable, gint sort_column_id, GtkSortType order) {
+    PifSongModel *model = PIF_SONG_MODEL(sortable);
+    if (sort_column_id == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID) {
+        sort_column_id = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;  // Library order is the default
+    }
+    if (sort_column_id >= PIF_SONG_N_COLUMNS ||
+        (sort_column_id < 0 && sort_column_id != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID)) {
+        g_warning("%s: no sort column %d", G_STRFUNC, sort_column_id);
+        return;
+    }
+    if (model->sort_column == sort_column_id && (!sorted(model) || model->sort_order == order)) {
+        return;
+    }
+
+    gint old_column = model->sort_column;
+    GtkSortType old_order = model->sort_order;
+    model->sort_column = sort_column_id;
+    model->sort_order = order;
+    uint32_t *rows;
+    uint32_t count;
+    if (make_order(model, &model->lib, model->query, &rows, &count) == -1) {
+        model->sort_column = old_column;
+        model->sort_order = old_order;
+        g_warning("Cannot sort songs: %s", g_strerror(errno));
+        return;
+    }
+    sort_rows(model, rows, count);
+
+    // new_order[new position] = old position
+    gint *new_order = g_try_new(gint, count ? count : 1);
+    if (new_order != NULL) {
+        for (uint32_t k = 0; k < count; k++) {
+            guint pos;
+            guint row = rows != NULL ? rows[k] : k;
+            if (model->filter == NULL) {
+                pos = row;
+            } else {
+                // The old order is still in place, and so is its comparison
+                gint column = model->sort_column;
+                GtkSortType sort = model->sort_order;
+                model->sort_column = old_column;
+                model->sort_order = old_order;
+                view_row(model, row, &pos);
+                model->sort_column = column;
+                model->sort_order = sort;
+            }
+            new_order[k] = (gint)pos;
+        }
+    }
+    free(model->filter);
+    model->filter = rows;
+    gtk_tree_sortable_sort_column_changed(sortable);
+    if (new_order != NULL && count > 0) {
+        GtkTreePath *path = gtk_tree_path_new();
+        gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, new_order);
+        gtk_tree_path_free(path);
+    }
+    g_free(new_order);
+}
+
+static void set_sort_func(GtkTreeSortable *sortable, gint sort_column_id, GtkTreeIterCompareFunc func,
+                          gpointer data, GDestroyNotify destroy) {
+    (void)sortable;        // Suppress unused parameter warning
+    (void)sort_column_id;  // Suppress unused parameter warning
+    (void)func;            // Suppress unused parameter warning
+    if (destroy != NULL) {
+        destroy(data);
+    }
+    g_warning("%s: the song model sorts by its own keys", G_STRFUNC);
+}
+
+static gboolean has_default_sort_func(GtkTreeSortable *sortable) {
+    (void)sortable;  // Suppress unused parameter warning
+    return TRUE;
+}
+
+static void pif_song_model_tree_sortable_init(GtkTreeSortableIface *iface) {
+    iface->get_sort_column_id = get_sort_column_id;
+    iface->set_sort_column_id = set_sort_column_id;
+    iface->set_sort_func = set_sort_func;
+    iface->has_default_sort_func = has_default_sort_func;
+}
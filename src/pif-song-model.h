@@ -0,0 +1,84 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIF_SONG_MODEL_H
+#define PIF_SONG_MODEL_H
+
+#include <gtk/gtk.h>
+
+#include "libpif.h"
+
+// A flat GtkTreeModel over a pif_library. Rows are the library's song
+// records; column values are formatted on demand, so only rows the view
+// actually draws cost anything beyond the library itself.
+//
+// The model is also a GtkTreeSortable over these columns. Names are
+// compared by collation key, frequencies with rotation first and due dates
+// with rotation and unscheduled songs last. Keys are computed the first
+// time a song is sorted and kept until that song is edited.
+//
+// A song that looks due by its cached time is confirmed against the
+// practice history on a worker thread, batched with the other rows drawn
+// meanwhile; its row is reported changed once the answer is in.
+enum {
+    PIF_SONG_COL_NAME,
+    PIF_SONG_COL_FREQ,
+    PIF_SONG_COL_DUE,
+    PIF_SONG_N_COLUMNS
+};
+
+#define PIF_TYPE_SONG_MODEL (pif_song_model_get_type())
+G_DECLARE_FINAL_TYPE(PifSongModel, pif_song_model, PIF, SONG_MODEL, GObject)
+
+// Take over an opened library; it is closed with the model
+PifSongModel *pif_song_model_new(struct pif_library *lib);
+
+struct pif_library *pif_song_model_get_library(PifSongModel *model);
+
+// Library row of an iter from this model
+guint pif_song_model_iter_row(PifSongModel *model, GtkTreeIter *iter);
+
+// Iter for a library row, if the filter lets it through. Rows may move
+// in the view when an edit changes their sort key.
+gboolean pif_song_model_get_iter_for_row(PifSongModel *model, guint row, GtkTreeIter *iter);
+
+// Edit the library and tell the view. Return 0 or -1 with errno set;
+// appending a song whose name is taken fails with EEXIST.
+int pif_song_model_append(PifSongModel *model, const char *line, size_t len);
+int pif_song_model_remove(PifSongModel *model, guint row);
+int pif_song_model_replace(PifSongModel *model, guint row, const char *line, size_t len);
+
+// Add many "name freq" lines at once, skipping names already in the list.
+// The lines that were added are moved to the front of lines and lens, in
+// order, and counted in added; on failure part way they are still there.
+// The model must not be attached to a view while this runs.
+int pif_song_model_add_all(PifSongModel *model, const char **lines, uint32_t *lens, size_t count, size_t *added);
+
+// Only show songs whose name contains query; an empty query shows all.
+// The model must not be attached to a view while this runs.
+int pif_song_model_set_filter(PifSongModel *model, const char *query);
+
+// The practice history changed on disk: reopen it and take every
+// last-practice time and due key again as rows are next drawn. A view
+// sorted by due date is re-sorted. The caller redraws the view.
+void pif_song_model_practice_changed(PifSongModel *model);
+
+// Swap in a freshly opened library, telling the view only about the rows
+// that differ. Takes lib over on success.
+int pif_song_model_update(PifSongModel *model, struct pif_library *lib);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "pif-writer.h"
+#include "journal.h"
+
+#include <string.h>
+#include <errno.h>
+
+struct flush_report {
+    guint records;
+    off_t journal_size;
+    const char *msg;  // NULL on success
+    int err;
+};
+
+static struct {
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    char *fileloc;
+    struct pif_state *state;
+    char *practice_dir;
+    pif_writer_done_fn done;
+
+    // Protected by lock
+    GArray *records;  // struct pif_journal_record, lines owned
+    int songs_per_day;
+    gboolean config_dirty;
+    gint64 first_change;
+    gint64 last_change;
+    guint retry_ms;  // Backoff after failed writes, 0 after a success
+    gint64 retry_at;
+    gboolean stopping;
+} writer;
+
+static gboolean report(gpointer data) {
+    struct flush_report *r = data;
+    writer.done(r->records, r->journal_size, r->msg, r->err);
+    g_free(r);
+    return G_SOURCE_REMOVE;
+}
+
+static void post(guint records, off_t journal_size, const char *msg, int err) {
+    struct flush_report *r = g_new(struct flush_report, 1);
+    *r = (struct flush_report){ records, journal_size, msg, err };
+    g_idle_add(report, r);
+}
+
+static void free_records(GArray *records) {
+    for (guint i = 0; i < records->len; i++) {
+        g_free((char *)g_array_index(records, struct pif_journal_record, i).line);
+    }
+    g_array_unref(records);
+}
+
+// Write one batch, with the lock released. Returns -1 if the journal
+// records were not written, in which case none of them were. The failure
+// is reported on the first try, and on the last one before stopping.
+static int flush(GArray *records, int songs_per_day, gboolean first_try, gboolean last_try) {
+    off_t size = 0;
+    int rc = 0;
+    if (records->len > 0) {
+        int stale = pif_journal_append_all(writer.fileloc, (struct pif_journal_record *)(void *)records->data,
+                                           records->len, &size);
+        if (stale == -1) {
+            rc = -1;
+            if (last_try) {
+                g_printerr("Failed to save %u changes to %s" PIF_JOURNAL_SUFFIX ": %s\n", records->len,
+                           writer.fileloc, g_strerror(errno));
+            } else if (first_try) {
+                post(0, 0, "Failed to save changes; trying again", errno);
+            }
+        } else {
+            post(records->len, size, NULL, 0);
+        }
+        if (stale > 0) {
+            post(0, 0, "The songs file was changed outside pif; earlier edits were moved to its "
+                       PIF_JOURNAL_STALE_SUFFIX " file", ESTALE);
+        }
+    }
+    if (songs_per_day > 0) {
+        // Only this setting is ours; last_played belongs to whoever ran
+        // the rotation last
+        struct pif_config config;
+        if (pif_state_begin(writer.state, &config) == -1) {
+            post(0, 0, "Failed to save rotation state", errno);
+        } else {
+            config.songs_per_day = songs_per_day;
+            if (pif_state_commit(writer.state, &config) == -1) {
+                post(0, 0, "Failed to save rotation state", errno);
+            }
+        }
+    }
+
+    int stale = size >= PIF_JOURNAL_COMPACT_SIZE ? pif_journal_compact(writer.fileloc, writer.practice_dir) : 0;
+    if (stale == -1) {
+        // The journal is still intact, so nothing is lost; try again later
+        g_warning("Failed to compact journal: %s", g_strerror(errno));
+    } else if (stale > 0) {
+        post(0, 0, "The songs file was changed outside pif; earlier edits were moved to its "
+                   PIF_JOURNAL_STALE_SUFFIX " file", ESTALE);
+    }
+    return rc;
+}
+
+// Call with the lock held. Failed records go back ahead of anything queued
+// since, as later edits may refer to the rows they leave behind.
+static void requeue(GArray *records) {
+    g_array_prepend_vals(writer.records, records->data, records->len);
+    g_array_unref(records);
+    writer.retry_ms = writer.retry_ms != 0 ? MIN(writer.retry_ms * 2, PIF_WRITER_MAX_RETRY_MS) : PIF_WRITER_RETRY_MS;
+    writer.retry_at = g_get_monotonic_time() + writer.retry_ms * G_TIME_SPAN_MILLISECOND;
+}
+
+static gpointer writer_thread(gpointer data) {
+    (void)data;  // Suppress unused parameter warning
+
+    g_mutex_lock(&writer.lock);
+    for (;;) {
+        while (writer.records->len == 0 && !writer.config_dirty && !writer.stopping) {
+            g_cond_wait(&writer.cond, &writer.lock);
+        }
+
+        // Let a burst of edits settle so it costs one write, and after a
+        // failure give the disk a while to recover
+        while (!writer.stopping) {
+            gint64 until = MIN(writer.last_change + PIF_WRITER_DELAY_MS * G_TIME_SPAN_MILLISECOND,
+                               writer.first_change + PIF_WRITER_MAX_DELAY_MS * G_TIME_SPAN_MILLISECOND);
+            until = MAX(until, writer.retry_at);
+            if (g_get_monotonic_time() >= until) {
+                break;
+            }
+            g_cond_wait_until(&writer.cond, &writer.lock, until);
+        }
+
+        GArray *records = writer.records;
+        writer.records = g_array_new(FALSE, FALSE, sizeof(struct pif_journal_record));
+        int songs_per_day = writer.config_dirty ? writer.songs_per_day : 0;
+        writer.config_dirty = FALSE;
+        gboolean stopping = writer.stopping;
+        gboolean first_try = writer.retry_ms == 0;
+
+        g_mutex_unlock(&writer.lock);
+        int rc = flush(records, songs_per_day, first_try, stopping);
+        g_mutex_lock(&writer.lock);
+        if (rc == -1 && !stopping) {
+            requeue(records);
+        } else {
+            free_records(records);
+            writer.retry_ms = 0;
+            writer.retry_at = 0;
+        }
+
+        if (stopping && writer.records->len == 0 && !writer.config_dirty) {
+            break;
+        }
+    }
+    g_mutex_unlock(&writer.lock);
+
+    // Leave ~/.pif up to date for the next run
+    int stale = pif_journal_compact(writer.fileloc, writer.practice_dir);
+    if (stale == -1) {
+        g_printerr("Failed to compact journal: %s\n", g_strerror(errno));
+    } else if (stale > 0) {
+        g_printerr("%s was changed outside pif; %d earlier edits were moved to %s" PIF_JOURNAL_STALE_SUFFIX "\n",
+                   writer.fileloc, stale, writer.fileloc);
+    }
+    return NULL;
+}
+
+void pif_writer_start(const char *fileloc, struct pif_state *state, const char *practice_dir,
+                      pif_writer_done_fn done) {
+    writer.fileloc = g_strdup(fileloc);
+    writer.state = state;
+    writer.practice_dir = g_strdup(practice_dir);
+    writer.done = done;
+    writer.records = g_array_new(FALSE, FALSE, sizeof(struct pif_journal_record));
+    writer.thread = g_thread_new("pif-writer", writer_thread, NULL);
+}
+
+// Call with the lock held
+static void changed(void) {
+    gint64 now = g_get_monotonic_time();
+    if (writer.records->len == 0 && !writer.config_dirty) {
+        writer.first_change = now;
+    }
+    writer.last_change = now;
+    g_cond_signal(&writer.cond);
+}
+
+void pif_writer_journal(char op, guint row, const char *line) {
+    struct pif_journal_record record = { op, row, g_strdup(line), strlen(line) };
+    g_mutex_lock(&writer.lock);
+    changed();
+    g_array_append_val(writer.records, record);
+    g_mutex_unlock(&writer.lock);
+}
+
+void pif_writer_journal_all(const struct pif_journal_record *records, guint count) {
+    g_mutex_lock(&writer.lock);
+    changed();
+    for (guint i = 0; i < count; i++) {
+        struct pif_journal_record record = records[i];
+        record.line = g_strndup(records[i].line, records[i].len);
+        g_array_append_val(writer.records, record);
+    }
+    g_mutex_unlock(&writer.lock);
+}
+
+void pif_writer_songs_per_day(int songs_per_day) {
+    g_mutex_lock(&writer.lock);
+    changed();
+    writer.songs_per_day = songs_per_day;
+    writer.config_dirty = TRUE;
+    g_mutex_unlock(&writer.lock);
+}
+
+void pif_writer_stop(void) {
+    if (writer.thread == NULL) {
+        return;
+    }
+    g_mutex_lock(&writer.lock);
+    writer.stopping = TRUE;
+    g_cond_signal(&writer.cond);
+    g_mutex_unlock(&writer.lock);
+    g_thread_join(writer.thread);
+    writer.thread = NULL;
+
+    free_records(writer.records);
+    g_free(writer.fileloc);
+    g_free(writer.practice_dir);
+}
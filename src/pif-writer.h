@@ -0,0 +1,64 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIF_WRITER_H
+#define PIF_WRITER_H
+
+#include <glib.h>
+#include <sys/types.h>
+
+#include "state.h"
+
+struct pif_journal_record;
+
+// Background writer for pif-gtk. The main loop only queues edits; a worker
+// thread waits for a burst to settle, then appends all queued journal
+// records in one write and stores the songs-per-day setting in the
+// rotation state. Once the journal grows past PIF_JOURNAL_COMPACT_SIZE it
+// is compacted on the same thread. Records the journal would not take stay
+// queued, ahead of any newer ones, and are tried again after a delay that
+// doubles with each failure.
+#define PIF_WRITER_DELAY_MS 300     // Quiet time that ends a burst
+#define PIF_WRITER_MAX_DELAY_MS 2000  // Longest an edit waits to be written
+#define PIF_WRITER_RETRY_MS 1000    // First wait after a failed write
+#define PIF_WRITER_MAX_RETRY_MS 60000
+
+// Called on the main loop after each flush with the number of journal
+// records it wrote and the journal's new size. If writing failed, msg and
+// err describe the failure; the first failed attempt at a batch is
+// reported with no records, as they are still queued.
+typedef void (*pif_writer_done_fn)(guint records, off_t journal_size, const char *msg, int err);
+
+// state must outlive the writer
+void pif_writer_start(const char *fileloc, struct pif_state *state, const char *practice_dir,
+                      pif_writer_done_fn done);
+
+// Queue a journal record; line is copied
+void pif_writer_journal(char op, guint row, const char *line);
+
+// Queue many records at once, so they are written together; lines are
+// copied
+void pif_writer_journal_all(const struct pif_journal_record *records, guint count);
+
+// Queue a songs-per-day change; only the latest one is written
+void pif_writer_songs_per_day(int songs_per_day);
+
+// Write everything still queued, compact the journal and stop the thread.
+// Records that still cannot be written are reported on stderr and dropped.
+void pif_writer_stop(void);
+
+#endif
@@ -23,238 +23,416 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
-
-// Rotation configuration
-int songs_per_day = 3;  // Default value
-int last_played = 0;    // Track last played song
+#include <limits.h>
+
+#include "libpif.h"
+#include "batch.h"
+#include "edit.h"
+#include "import.h"
+#include "ipc.h"
+#include "journal.h"
+#include "notify.h"
+#include "state.h"
+#include "trace.h"
 
 void handle_error(const char *msg) {
   fprintf(stderr, "Error: %s: %s\n", msg, strerror(errno));
   exit(1);
 }
 
-char* get_word(const char* line, int word_num) {
-  if (line == NULL || word_num < 0) {
-    return NULL;
-  }
+// Edits journaled before ~/.pif was changed by hand are kept, but no longer
+// in the list
+static void warn_stale(const char *fileloc, int stale) {
+    if (stale > 0) {
+        fprintf(stderr, "Warning: %s was changed outside pif; %d earlier edits were moved to %s"
+                PIF_JOURNAL_STALE_SUFFIX "\n", fileloc, stale, fileloc);
+    }
+}
 
-  char* line_copy = strdup(line);
-  if (line_copy == NULL) {
-    return NULL;
+// Find word word_num (0-based, split on spaces and tabs) in a line
+static int find_word(const char *line, size_t len, int word_num, size_t *start) {
+  size_t i = 0;
+  for (int word = 0; ; word++) {
+    while (i < len && (line[i] == ' ' || line[i] == '\t')) {
+      i++;
+    }
+    if (i == len) {
+      return -1;
+    }
+    if (word == word_num) {
+      *start = i;
+      return 0;
+    }
+    while (i < len && line[i] != ' ' && line[i] != '\t') {
+      i++;
+    }
   }
+}
 
-  char* word = strtok(line_copy, " \t");
-  int current_word = 0;
-
-  while (word != NULL && current_word < word_num) {
-    word = strtok(NULL, " \t");
-    current_word++;
+void ins_txt(const char* fileloc, const char* practice_dir, int line_num, int word_num, const char* text) {
+  if (line_num < 1 || word_num < 0) {
+    printf("Warning: Could not insert text at specified position\n");
+    return;
   }
 
-  char* result = NULL;
-  if (word != NULL) {
-    result = strdup(word);
+  // The snapshot knows where every line starts, so only this one is read
+  struct practice_source practice;
+  practice_source_init(&practice, practice_dir);
+  struct pifdb db;
+  if (pifdb_open(&db, fileloc, &practice) == -1) {
+    handle_error("Failed to open file");
   }
-
-  free(line_copy);
-  return result;
-}
-
-void ins_txt(const char* fileloc, int line_num, int word_num, const char* text) {
-  FILE* file = fopen(fileloc, "r+");
-  if (file == NULL) {
-    handle_error("Failed to open file for reading and writing");
+  size_t start;
+  const char *line = (uint32_t)line_num <= db.count ? pifdb_line(&db, line_num - 1) : NULL;
+  int found = line != NULL && find_word(line, db.line_len[line_num - 1], word_num, &start) == 0;
+  pifdb_close(&db);
+  practice_source_close(&practice);
+  if (!found) {
+    printf("Warning: Could not insert text at specified position\n");
+    return;
   }
 
-  // Create a temporary file
-  char temp_path[] = "/tmp/pif_temp_XXXXXX";
-  int temp_fd = mkstemp(temp_path);
-  if (temp_fd == -1) {
-    fclose(file);
-    handle_error("Failed to create temporary file");
+  // Insert "text " in front of the word, rewriting only the rest of the file
+  size_t len = strlen(text);
+  char *insert = malloc(len + 1);
+  if (insert == NULL) {
+    handle_error("Memory allocation failed");
   }
-  FILE* temp_file = fdopen(temp_fd, "w");
-  if (temp_file == NULL) {
-    close(temp_fd);
-    fclose(file);
-    handle_error("Failed to open temporary file");
+  memcpy(insert, text, len);
+  insert[len] = ' ';
+  int stale = pif_edit_splice(fileloc, practice_dir, (uint32_t)(line_num - 1), start, 0, insert, len + 1);
+  if (stale == -1) {
+    handle_error("Failed to edit file");
   }
+  warn_stale(fileloc, stale);
+  free(insert);
+}
 
-  char line[1024];
-  int current_line = 1;
-  int inserted = 0;
-
-  // Copy lines to temp file, inserting text at specified position
-  while (fgets(line, sizeof(line), file)) {
-    if (current_line == line_num) {
-      char* word = get_word(line, word_num);
-      if (word != NULL) {
-        // Insert text at the specified word position
-        char* word_start = strstr(line, word);
-        if (word_start != NULL) {
-          fwrite(line, 1, word_start - line, temp_file);
-          fputs(text, temp_file);
-          fputs(" ", temp_file);
-          fputs(word_start, temp_file);
-          inserted = 1;
-        }
-      }
-      free(word);
-    } else {
-      fputs(line, temp_file);
+// Record that a song was practiced just now
+void mark_practiced(const char *practice_dir, const char *song) {
+    if (practice_record(practice_dir, song, strlen(song), time(NULL)) == -1) {
+        handle_error("Failed to record practice");
     }
-    current_line++;
-  }
+}
 
-  fclose(file);
-  fclose(temp_file);
+void migrate_practice(const char *practice_dir) {
+    char logloc[PATH_MAX];
+    size_t len = snprintf(logloc, sizeof(logloc), "%s/" PRACTICE_LOG_NAME, practice_dir);
+    if (len >= sizeof(logloc)) {
+        handle_error("Path too long");
+    }
 
-  // Replace original file with temp file
-  if (rename(temp_path, fileloc) != 0) {
-    handle_error("Failed to replace original file");
-  }
+    long imported = practice_log_migrate(logloc, practice_dir);
+    if (imported == -1) {
+        handle_error("Failed to migrate practice history");
+    }
+    printf("Imported practice history for %ld songs into %s\n", imported, logloc);
+}
 
-  if (!inserted) {
-    printf("Warning: Could not insert text at specified position\n");
-  }
+void usage(void) {
+    fprintf(stderr, "Usage: pif [--rotation | --due | --next-due | --plan DAYS | --notify | --practiced SONG |\n"
+                    "           --migrate-practice]\n"
+                    "       pif --batch [--rotation] [--jobs N] DIR... | -\n"
+                    "       pif --import [--freq FREQ] [--jobs N] FILE|DIR... | -\n"
+                    "Any of them can be preceded by --stats or --stats=json for a timing report.\n");
+    exit(1);
 }
 
-void load_rotation_config(const char *configloc) {
-    FILE *file = fopen(configloc, "r");
-    if (file == NULL) {
-        if (errno != ENOENT) {
-            handle_error("Failed to open config file");
-        }
-        return;
+// Hand the request to a running pifd, copying its answer to out_fd.
+// Returns the exit status, or -1 if no daemon is running and the work has
+// to be done here.
+static int ask_daemon(const char *request, int out_fd) {
+    char path[PATH_MAX];
+    if (pif_ipc_socket_path(path, sizeof(path)) == -1) {
+        return -1;
+    }
+    int fd = pif_ipc_connect(path);
+    if (fd == -1) {
+        return -1;
     }
 
-    char line[256];
-    if (fgets(line, sizeof(line), file)) {
-        sscanf(line, "songs_per_day=%d\n", &songs_per_day);
+    int status;
+    char err[512];
+    fflush(stdout);
+    if (pif_ipc_call(fd, request, out_fd, &status, err, sizeof(err)) == -1) {
+        handle_error("Failed to talk to pifd");
     }
-    if (fgets(line, sizeof(line), file)) {
-        sscanf(line, "last_played=%d\n", &last_played);
+    if (status != 0) {
+        fprintf(stderr, "Error: %s\n", err);
+        return 1;
     }
-    fclose(file);
+    return 0;
 }
 
-void save_rotation_config(const char *configloc) {
-    FILE *file = fopen(configloc, "w");
-    if (file == NULL) {
-        handle_error("Failed to open config file for writing");
+// Show today's list as a desktop notification; an empty one is not shown
+static void send_notification(const char *body) {
+    if (body[0] == '\0') {
         return;
     }
-
-    fprintf(file, "songs_per_day=%d\n", songs_per_day);
-    fprintf(file, "last_played=%d\n", last_played);
-    fclose(file);
+    char err[512];
+    if (pif_notify(body, err, sizeof(err)) == -1) {
+        fprintf(stderr, "Error: Failed to send notification: %s\n", err);
+        exit(1);
+    }
 }
 
-// Function to get songs for today's rotation
-void get_todays_songs(const char *fileloc, char ***songs, int *num_songs) {
-    FILE *file = fopen(fileloc, "r");
-    if (file == NULL) {
-        handle_error("Failed to open songs file");
+// Collect the daemon's answer in memory for --notify
+static int ask_daemon_notify(const char *request) {
+    int fd = memfd_create("pif-notify", MFD_CLOEXEC);
+    if (fd == -1) {
+        handle_error("Failed to create buffer");
     }
-
-    // First pass: count total number of rotation songs
-    int total_rotation_songs = 0;
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;  // Remove newline
-        char *freq = strrchr(line, ' ');
-        if (freq != NULL && strcmp(freq + 1, "rot") == 0) {
-            total_rotation_songs++;
-        }
+    int rc = ask_daemon(request, fd);
+    if (rc != 0) {
+        close(fd);
+        return rc;
     }
-    rewind(file);
 
-    if (total_rotation_songs == 0) {
-        *num_songs = 0;
-        *songs = NULL;
-        fclose(file);
-        return;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        handle_error("Failed to read daemon reply");
     }
-
-    // Calculate which songs to play today
-    int start_idx = last_played % total_rotation_songs;
-    *num_songs = (songs_per_day < total_rotation_songs) ? songs_per_day : total_rotation_songs;
-    
-    // Allocate memory for songs
-    *songs = malloc(sizeof(char*) * (*num_songs));
-    if (*songs == NULL) {
-        fclose(file);
+    char *body = malloc((size_t)st.st_size + 1);
+    if (body == NULL) {
         handle_error("Memory allocation failed");
     }
+    if (pread(fd, body, (size_t)st.st_size, 0) != st.st_size) {
+        handle_error("Failed to read daemon reply");
+    }
+    body[st.st_size] = '\0';
+    close(fd);
+    send_notification(body);
+    free(body);
+    return 0;
+}
+
+// pif --batch: run over many profile directories, named on the command
+// line or one per line on stdin
+static int run_batch(int argc, char **argv) {
+    int peek = 0;
+    unsigned long jobs = 0;
+    int i = 0;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--rotation") == 0) {
+            peek = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            char *end;
+            errno = 0;
+            jobs = strtoul(argv[++i], &end, 10);
+            if (errno != 0 || end == argv[i] || *end != '\0' || jobs < 1 || jobs > PIF_BATCH_MAX_JOBS) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (i == argc) {
+        usage();
+    }
 
-    // Second pass: collect rotation songs
-    int current_rotation_song = 0;
-    int songs_collected = 0;
-    while (fgets(line, sizeof(line), file) && songs_collected < *num_songs) {
-        line[strcspn(line, "\n")] = 0;  // Remove newline
-        char *freq = strrchr(line, ' ');
-        
-        if (freq != NULL && strcmp(freq + 1, "rot") == 0) {
-            if (current_rotation_song >= start_idx) {
-                // Extract song name (everything before the last space)
-                *freq = '\0';
-                (*songs)[songs_collected] = strdup(line);
-                if ((*songs)[songs_collected] == NULL) {
-                    for (int j = 0; j < songs_collected; j++) {
-                        free((*songs)[j]);
-                    }
-                    free(*songs);
-                    fclose(file);
+    char **dirs = argv + i;
+    size_t count = (size_t)(argc - i);
+    char *line = NULL;
+    if (count == 1 && strcmp(dirs[0], "-") == 0) {
+        size_t cap = 0, size = 0;
+        ssize_t len;
+        dirs = NULL;
+        count = 0;
+        while ((len = getline(&line, &size, stdin)) != -1) {
+            if (len > 0 && line[len - 1] == '\n') {
+                line[--len] = '\0';
+            }
+            if (len == 0) {
+                continue;
+            }
+            if (count == cap) {
+                cap = cap ? cap * 2 : 64;
+                char **grown = realloc(dirs, cap * sizeof(*dirs));
+                if (grown == NULL) {
                     handle_error("Memory allocation failed");
                 }
-                songs_collected++;
+                dirs = grown;
+            }
+            if ((dirs[count++] = strdup(line)) == NULL) {
+                handle_error("Memory allocation failed");
             }
-            current_rotation_song++;
+        }
+        if (ferror(stdin)) {
+            handle_error("Failed to read profile list");
         }
     }
 
-    // Update last_played
-    last_played = (start_idx + *num_songs) % total_rotation_songs;
-    fclose(file);
+    size_t failed = pif_batch_run(dirs, count, peek, (unsigned)jobs, stdout);
+    if (dirs != argv + i) {
+        for (size_t j = 0; j < count; j++) {
+            free(dirs[j]);
+        }
+        free(dirs);
+        free(line);
+    }
+    return failed > 0 ? 1 : 0;
 }
 
-// Function to check if a song is due for practice based on frequency
-int is_song_due(const char *song_name, const char *freq) {
-    if (freq == NULL || *freq == '\0') {
-        return 0;  // Ignore songs with no frequency
+// pif --import: add the songs of CSV files, playlists and directories of
+// scores that are not in the library yet, in one journal write
+static int run_import(int argc, char **argv, const char *fileloc, const char *practice_dir) {
+    struct pif_import import = PIF_IMPORT_INIT;
+    unsigned long jobs = 0;
+    int i = 0;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--freq") == 0 && i + 1 < argc) {
+            import.freq = argv[++i];
+            if (pif_parse_freq(import.freq, strlen(import.freq)) == PIF_FREQ_NONE) {
+                usage();
+            }
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            char *end;
+            errno = 0;
+            jobs = strtoul(argv[++i], &end, 10);
+            if (errno != 0 || end == argv[i] || *end != '\0' || jobs < 1 || jobs > PIF_IMPORT_MAX_JOBS) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (i == argc) {
+        usage();
     }
 
-    if (strcmp(freq, "rot") == 0) {
-        return 0;  // Rotation songs are handled separately
+    for (; i < argc; i++) {
+        if (pif_import_read(&import, argv[i], (unsigned)jobs) == -1) {
+            fprintf(stderr, "Error: %s: Failed to import songs: %s\n", argv[i], strerror(errno));
+            exit(1);
+        }
+    }
+    for (size_t k = 0; k < import.skipped_count; k++) {
+        fprintf(stderr, "Warning: %s: Skipped folder: %s\n", import.skipped[k].path,
+                strerror(import.skipped[k].err));
     }
 
-    // Check if frequency is a valid number
-    char *endptr;
-    long days = strtol(freq, &endptr, 10);
-    if (*endptr != '\0' || days <= 0) {
-        return 0;  // Invalid frequency
+    // A first import starts the library; the journal needs a ~/.pif to
+    // belong to
+    int fd = open(fileloc, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        handle_error("Failed to create songs file");
     }
+    close(fd);
 
-    // Check last practice time
-    char last_practice_file[512];
-    snprintf(last_practice_file, sizeof(last_practice_file), "%s/.pif_last_practice_%s", getenv("HOME"), song_name);
-    
-    struct stat st;
-    if (stat(last_practice_file, &st) == -1) {
-        return 1;  // No last practice record, so it's due
+    struct pif_arena run = PIF_ARENA_INIT;
+    struct pif_library lib;
+    if (pif_library_open_run(&lib, fileloc, practice_dir, &run) == -1) {
+        handle_error("Failed to open songs file");
+    }
+
+    // Songs already in the list, or twice in the import, are added once
+    struct pif_journal_record *records = pif_arena_alloc(&run, (import.count ? import.count : 1) * sizeof(*records));
+    if (records == NULL) {
+        handle_error("Memory allocation failed");
+    }
+    size_t added = 0;
+    for (size_t k = 0; k < import.count; k++) {
+        if (pif_library_add(&lib, import.lines[k], import.lens[k]) == -1) {
+            if (errno != EEXIST) {
+                handle_error("Failed to add songs");
+            }
+            continue;
+        }
+        records[added++] = (struct pif_journal_record){ PIF_JOURNAL_ADD, 0, import.lines[k], import.lens[k] };
     }
 
-    time_t now = time(NULL);
-    time_t last_practice = st.st_mtime;
-    time_t days_since = (now - last_practice) / (24 * 3600);
+    off_t journal_size = 0;
+    int stale = added > 0 ? pif_journal_append_all(fileloc, records, added, &journal_size) : 0;
+    if (stale == -1) {
+        handle_error("Failed to save songs");
+    }
+    warn_stale(fileloc, stale);
+    pif_library_close(&lib);
+    pif_arena_free(&run);
+    if (journal_size >= PIF_JOURNAL_COMPACT_SIZE) {
+        stale = pif_journal_compact(fileloc, practice_dir);
+        if (stale == -1) {
+            // The journal is still intact, so nothing is lost
+            fprintf(stderr, "Warning: Failed to compact journal: %s\n", strerror(errno));
+        }
+        warn_stale(fileloc, stale);
+    }
 
-    return days_since >= days;
+    printf("Imported %zu songs, skipped %zu already in the list\n", added, import.count - added);
+    pif_import_free(&import);
+    return 0;
 }
 
-int main(void) {
+enum mode { MODE_TODAY, MODE_ROTATION, MODE_DUE, MODE_NEXT_DUE, MODE_PLAN, MODE_NOTIFY };
+
+int main(int argc, char **argv) {
+    // Settle what to do before touching the home directory, so a running
+    // pifd can answer straight away
+    enum mode mode = MODE_TODAY;
+    unsigned long plan_days = 0;
+    char request[PIF_IPC_MAX_REQUEST];
+    request[0] = '\0';
+    enum pif_trace_format stats = PIF_TRACE_OFF;
+    if (argc >= 2 && strcmp(argv[1], "--stats") == 0) {
+        stats = PIF_TRACE_TEXT;
+    } else if (argc >= 2 && strcmp(argv[1], "--stats=json") == 0) {
+        stats = PIF_TRACE_JSON;
+    }
+    if (stats != PIF_TRACE_OFF) {
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    pif_trace_init(stats, 1);
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc - 2, argv + 2);  // Other users' profiles are never the daemon's
+    } else if (argc == 1) {
+        strcpy(request, "today");
+    } else if (argc == 2 && strcmp(argv[1], "--rotation") == 0) {
+        mode = MODE_ROTATION;
+        strcpy(request, "rotation");
+    } else if (argc == 2 && strcmp(argv[1], "--due") == 0) {
+        mode = MODE_DUE;
+        strcpy(request, "due");
+    } else if (argc == 2 && strcmp(argv[1], "--next-due") == 0) {
+        mode = MODE_NEXT_DUE;
+        strcpy(request, "next-due");
+    } else if (argc == 3 && strcmp(argv[1], "--plan") == 0) {
+        char *end;
+        errno = 0;
+        plan_days = strtoul(argv[2], &end, 10);
+        if (errno != 0 || end == argv[2] || *end != '\0' || plan_days < 1 || plan_days > PIF_PLAN_MAX_DAYS) {
+            usage();
+        }
+        mode = MODE_PLAN;
+        snprintf(request, sizeof(request), "plan %lu", plan_days);
+    } else if (argc == 2 && strcmp(argv[1], "--notify") == 0) {
+        mode = MODE_NOTIFY;
+        strcpy(request, "today");
+    } else if (argc == 3 && strcmp(argv[1], "--practiced") == 0) {
+        // Names that do not fit a request are recorded locally
+        size_t len = snprintf(request, sizeof(request), "practiced %s", argv[2]);
+        if (len >= sizeof(request) || strchr(argv[2], '\n') != NULL) {
+            request[0] = '\0';
+        }
+    } else if (!(argc == 2 && strcmp(argv[1], "--migrate-practice") == 0) && strcmp(argv[1], "--import") != 0) {
+        usage();
+    }
+    if (request[0] != '\0') {
+        struct pif_trace_span span;
+        pif_trace_begin(&span);
+        int rc = mode == MODE_NOTIFY ? ask_daemon_notify(request) : ask_daemon(request, STDOUT_FILENO);
+        pif_trace_end(&span, PIF_PHASE_DAEMON);
+        if (rc != -1) {
+            return rc;
+        }
+    }
+
     char* homedir;
     uid_t uid = getuid();
 
@@ -280,51 +458,123 @@ int main(void) {
         handle_error("Path too long");
     }
 
-    // Load rotation config
-    load_rotation_config(configloc);
+    char stateloc[267];
+    len = snprintf(stateloc, sizeof(stateloc), "%s/" PIF_STATE_NAME, homedir);
+    if (len >= sizeof(stateloc)) {
+        handle_error("Path too long");
+    }
+
+    // Practice history lives next to the legacy per-song files
+    const char *practice_dir = getenv("HOME") != NULL ? getenv("HOME") : homedir;
+
+    if (argc == 3 && strcmp(argv[1], "--practiced") == 0) {
+        mark_practiced(practice_dir, argv[2]);
+        return 0;
+    } else if (argc == 2 && strcmp(argv[1], "--migrate-practice") == 0) {
+        migrate_practice(practice_dir);
+        return 0;
+    } else if (argc >= 2 && strcmp(argv[1], "--import") == 0) {
+        return run_import(argc - 2, argv + 2, fileloc, practice_dir);
+    }
 
-    // Get today's rotation songs
-    char **rotation_songs = NULL;
-    int num_rotation_songs = 0;
-    get_todays_songs(fileloc, &rotation_songs, &num_rotation_songs);
+    // Rotation state, created from the old ~/.pif-config on first use
+    struct pif_state state;
+    if (pif_state_open(&state, stateloc, configloc) == -1) {
+        handle_error("Failed to open rotation state");
+    }
+
+    // Open the library, rebuilding its snapshot if ~/.pif changed. Song
+    // data and every list below live in one arena, let go of at exit.
+    struct pif_arena run = PIF_ARENA_INIT;
+    struct pif_library lib;
+    if (pif_library_open_run(&lib, fileloc, practice_dir, &run) == -1) {
+        handle_error("Failed to open songs file");
+    }
+
+    // --notify builds the same text in memory
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = stdout;
+    if (mode == MODE_NOTIFY && (out = open_memstream(&body, &body_len)) == NULL) {
+        handle_error("Memory allocation failed");
+    }
+
+    if (mode == MODE_NEXT_DUE) {
+        uint32_t row;
+        int64_t when;
+        int found = pif_library_next_due(&lib, &row, &when);
+        if (found == -1) {
+            handle_error("Failed to check practice history");
+        }
+        if (found) {
+            pif_print_next_due(stdout, &lib, row, when, time(NULL));
+        }
+        pif_library_close(&lib);
+        pif_arena_free(&run);
+        pif_state_close(&state);
+        return 0;
+    }
 
-    // Save updated rotation config
-    save_rotation_config(configloc);
+    if (mode == MODE_PLAN) {
+        struct pif_config config;
+        pif_state_read(&state, &config);
+        struct pif_plan plan;
+        time_t now = time(NULL);
+        if (pif_library_plan(&lib, &config, now, (uint32_t)plan_days, &plan) == -1) {
+            handle_error("Failed to plan practice");
+        }
+        pif_print_plan(stdout, &lib, &plan, now);
+        pif_library_close(&lib);
+        pif_arena_free(&run);
+        pif_state_close(&state);
+        return 0;
+    }
 
-    // Print today's rotation songs
-    if (num_rotation_songs > 0) {
-        printf("Today's rotation songs to practice:\n");
-        for (int i = 0; i < num_rotation_songs; i++) {
-            printf("%d. %s\n", i + 1, rotation_songs[i]);
-            free(rotation_songs[i]);
+    // Get today's rotation songs; --rotation only peeks at them. Taking
+    // them holds the state lock, so concurrent runs each get their own.
+    if (mode != MODE_DUE) {
+        struct pif_config config;
+        if (mode == MODE_ROTATION) {
+            pif_state_read(&state, &config);
+        } else if (pif_state_begin(&state, &config) == -1) {
+            handle_error("Failed to lock rotation state");
         }
-        free(rotation_songs);
+        uint32_t *rotation_songs =
+            pif_arena_alloc(&run, (config.songs_per_day > 0 ? config.songs_per_day : 1) * sizeof(*rotation_songs));
+        if (rotation_songs == NULL) {
+            handle_error("Memory allocation failed");
+        }
+        uint32_t num_rotation_songs = pif_library_rotation(&lib, &config, rotation_songs);
+        if (mode != MODE_ROTATION && pif_state_commit(&state, &config) == -1) {
+            handle_error("Failed to save rotation state");
+        }
+
+        pif_print_rotation(out, &lib, rotation_songs, num_rotation_songs);
     }
 
     // Check frequency-based songs
-    FILE *file = fopen(fileloc, "r");
-    if (file == NULL) {
-        handle_error("Failed to open songs file");
+    if (mode != MODE_ROTATION) {
+        uint32_t *due_songs;
+        uint32_t num_due;
+        if (pif_library_due(&lib, time(NULL), &due_songs, &num_due) == -1) {
+            handle_error("Failed to check practice history");
+        }
+        if (mode != MODE_DUE && num_due > 0) {
+            fputc('\n', out);
+        }
+        pif_print_due(out, &lib, due_songs, num_due);
     }
 
-    char line[256];
-    int has_frequency_songs = 0;
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;  // Remove newline
-        char *freq = strrchr(line, ' ');
-        if (freq != NULL) {
-            *freq = '\0';  // Split song name and frequency
-            freq++;  // Move past the space
-            if (is_song_due(line, freq)) {
-                if (!has_frequency_songs) {
-                    printf("\nSongs due for practice based on frequency:\n");
-                    has_frequency_songs = 1;
-                }
-                printf("- %s (every %s days)\n", line, freq);
-            }
+    if (mode == MODE_NOTIFY) {
+        if (fclose(out) == EOF) {
+            handle_error("Memory allocation failed");
         }
+        send_notification(body);
+        free(body);
     }
-    fclose(file);
 
+    pif_library_close(&lib);
+    pif_arena_free(&run);
+    pif_state_close(&state);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,700 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include "libpif.h"
+#include "journal.h"
+#include "ipc.h"
+#include "state.h"
+#include "trace.h"
+
+// pifd keeps the library and the practice history loaded and answers pif
+// over a Unix socket, so a query costs a socket round trip instead of a
+// full load. Changes on disk are noticed through inotify and picked up
+// before the next request is answered.
+
+#define CLIENT_TIMEOUT_SEC 1
+
+// Identity of a file as of our last read or write, so the events caused
+// by our own writes do not force a reload
+struct file_sig {
+    int exists;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+};
+
+static char fileloc[PATH_MAX];
+static char configloc[PATH_MAX];  // Legacy config, seeds the state file
+static char stateloc[PATH_MAX];
+static char journal_loc[PATH_MAX];
+static const char *practice_dir;
+
+static struct pif_library lib;
+static int lib_loaded;
+static struct file_sig lib_sig[2];  // ~/.pif and its journal
+static int lib_stale;
+
+// Shared with every other pif process; read fresh for each request
+static struct pif_state state = { -1, NULL };
+
+static int practice_stale;
+
+static volatile sig_atomic_t quit;
+
+static void handle_error(const char *msg) {
+    fprintf(stderr, "Error: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void file_sig_get(struct file_sig *sig, const char *path) {
+    struct stat st;
+    memset(sig, 0, sizeof(*sig));
+    if (stat(path, &st) == 0) {
+        sig->exists = 1;
+        sig->ino = st.st_ino;
+        sig->size = st.st_size;
+        sig->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+}
+
+static int file_sig_equal(const struct file_sig *a, const struct file_sig *b) {
+    return a->exists == b->exists && a->ino == b->ino && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+// Bring everything that changed on disk back in sync before a request
+static int refresh(const char **what) {
+    if (lib_stale || !lib_loaded) {
+        struct file_sig sig[2];
+        file_sig_get(&sig[0], fileloc);
+        file_sig_get(&sig[1], journal_loc);
+        if (!lib_loaded || !file_sig_equal(&sig[0], &lib_sig[0]) || !file_sig_equal(&sig[1], &lib_sig[1])) {
+            if (lib_loaded) {
+                pif_library_close(&lib);
+                lib_loaded = 0;
+            }
+            if (pif_library_open(&lib, fileloc, practice_dir) == -1) {
+                *what = "Failed to open songs file";
+                return -1;
+            }
+            lib_loaded = 1;
+            lib_sig[0] = sig[0];
+            lib_sig[1] = sig[1];
+            practice_stale = 0;
+        }
+        lib_stale = 0;
+    }
+
+    // Cached practice times only go stale in the "due" direction, so
+    // reopening the history is enough for the due checks to see it
+    if (practice_stale) {
+        practice_source_close(&lib.practice);
+        practice_source_init(&lib.practice, practice_dir);
+        practice_stale = 0;
+    }
+    return 0;
+}
+
+static int run_today(const char *arg, FILE *out, const char **what) {
+    (void)arg;  // Suppress unused parameter warning
+    struct pif_config config;
+    if (pif_state_begin(&state, &config) == -1) {
+        *what = "Failed to lock rotation state";
+        return -1;
+    }
+    uint32_t *rotation = malloc((config.songs_per_day > 0 ? config.songs_per_day : 1) * sizeof(*rotation));
+    if (rotation == NULL) {
+        pif_state_abort(&state);
+        *what = "Memory allocation failed";
+        return -1;
+    }
+    uint32_t num_rotation = pif_library_rotation(&lib, &config, rotation);
+    if (pif_state_commit(&state, &config) == -1) {
+        *what = "Failed to save rotation state";
+        free(rotation);
+        return -1;
+    }
+
+    uint32_t *due;
+    uint32_t num_due;
+    if (pif_library_due(&lib, time(NULL), &due, &num_due) == -1) {
+        *what = "Failed to check practice history";
+        free(rotation);
+        return -1;
+    }
+
+    pif_print_rotation(out, &lib, rotation, num_rotation);
+    if (num_due > 0) {
+        fputc('\n', out);
+    }
+    pif_print_due(out, &lib, due, num_due);
+    free(rotation);
+    free(due);
+    return 0;
+}
+
+static int run_rotation(const char *arg, FILE *out, const char **what) {
+    (void)arg;  // Suppress unused parameter warning
+    struct pif_config peek;
+    pif_state_read(&state, &peek);
+    uint32_t *rotation = malloc((peek.songs_per_day > 0 ? peek.songs_per_day : 1) * sizeof(*rotation));
+    if (rotation == NULL) {
+        *what = "Memory allocation failed";
+        return -1;
+    }
+    uint32_t num_rotation = pif_library_rotation(&lib, &peek, rotation);
+    pif_print_rotation(out, &lib, rotation, num_rotation);
+    free(rotation);
+    return 0;
+}
+
+static int run_due(const char *arg, FILE *out, const char **what) {
+    (void)arg;  // Suppress unused parameter warning
+    uint32_t *due;
+    uint32_t num_due;
+    if (pif_library_due(&lib, time(NULL), &due, &num_due) == -1) {
+        *what = "Failed to check practice history";
+        return -1;
+    }
+    pif_print_due(out, &lib, due, num_due);
+    free(due);
+    return 0;
+}
+
+static int run_next_due(const char *arg, FILE *out, const char **what) {
+    (void)arg;  // Suppress unused parameter warning
+    uint32_t row;
+    int64_t when;
+    int found = pif_library_next_due(&lib, &row, &when);
+    if (found == -1) {
+        *what = "Failed to check practice history";
+        return -1;
+    }
+    if (found) {
+        pif_print_next_due(out, &lib, row, when, time(NULL));
+    }
+    return 0;
+}
+
+static int run_plan(const char *arg, FILE *out, const char **what) {
+    char *end;
+    errno = 0;
+    unsigned long days = strtoul(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || days < 1 || days > PIF_PLAN_MAX_DAYS) {
+        errno = ERANGE;
+        *what = "Bad number of days";
+        return -1;
+    }
+    struct pif_config config;
+    pif_state_read(&state, &config);
+    struct pif_plan plan;
+    time_t now = time(NULL);
+    if (pif_library_plan(&lib, &config, now, (uint32_t)days, &plan) == -1) {
+        *what = "Failed to plan practice";
+        return -1;
+    }
+    pif_print_plan(out, &lib, &plan, now);
+    pif_plan_free(&plan);
+    return 0;
+}
+
+static int run_practiced(const char *arg, FILE *out, const char **what) {
+    (void)out;  // Suppress unused parameter warning
+    if (practice_record(practice_dir, arg, strlen(arg), time(NULL)) == -1) {
+        *what = "Failed to record practice";
+        return -1;
+    }
+    practice_stale = 1;
+    return 0;
+}
+
+// Edits journaled before ~/.pif was changed by hand are kept aside; the
+// songs they made are gone from the list, so reload it
+static void warn_stale(int stale) {
+    if (stale > 0) {
+        fprintf(stderr, "Warning: %s was changed outside pif; %d earlier edits were moved to %s"
+                PIF_JOURNAL_STALE_SUFFIX "\n", fileloc, stale, fileloc);
+        lib_stale = 1;
+    }
+}
+
+// Fold the journal into ~/.pif once it grows; the reload picks it up
+static void maybe_compact(off_t journal_size) {
+    file_sig_get(&lib_sig[1], journal_loc);
+    if (journal_size < PIF_JOURNAL_COMPACT_SIZE) {
+        return;
+    }
+    int stale = pif_journal_compact(fileloc, practice_dir);
+    if (stale == -1) {
+        fprintf(stderr, "Warning: Failed to compact journal: %s\n", strerror(errno));
+    }
+    warn_stale(stale);
+    lib_stale = 1;
+}
+
+static int run_add(const char *arg, FILE *out, const char **what) {
+    (void)out;  // Suppress unused parameter warning
+    size_t len = strlen(arg);
+    off_t journal_size;
+    if (len == 0) {
+        errno = EINVAL;
+        *what = "Empty song line";
+        return -1;
+    }
+    uint32_t name_len, row;
+    int32_t freq;
+    pif_parse_line(arg, len, &name_len, &freq);
+    int found = pif_library_find(&lib, arg, name_len, &row);
+    if (found == -1) {
+        *what = "Failed to look up song";
+        return -1;
+    }
+    if (found == 1) {
+        errno = EEXIST;
+        *what = "Song already exists";
+        return -1;
+    }
+    int stale = pif_journal_append(fileloc, PIF_JOURNAL_ADD, 0, arg, len, &journal_size);
+    if (stale == -1) {
+        *what = "Failed to write journal";
+        return -1;
+    }
+    warn_stale(stale);
+    if (pif_library_append(&lib, arg, len) == -1) {
+        *what = "Failed to add song";
+        lib_stale = 1;
+        memset(lib_sig, 0, sizeof(lib_sig));
+        return -1;
+    }
+    maybe_compact(journal_size);
+    return 0;
+}
+
+static int remove_row(uint32_t row, const char **what) {
+    const struct pif_song *song = &lib.songs[row];
+    off_t journal_size;
+    int stale = pif_journal_append(fileloc, PIF_JOURNAL_REMOVE, row, song->line, song->line_len, &journal_size);
+    if (stale == -1) {
+        *what = "Failed to write journal";
+        return -1;
+    }
+    warn_stale(stale);
+    if (pif_library_remove(&lib, row) == -1) {
+        *what = "Failed to remove song";
+        lib_stale = 1;
+        memset(lib_sig, 0, sizeof(lib_sig));
+        return -1;
+    }
+    maybe_compact(journal_size);
+    return 0;
+}
+
+static int run_remove(const char *arg, FILE *out, const char **what) {
+    (void)out;  // Suppress unused parameter warning
+    char *end;
+    errno = 0;
+    unsigned long line = strtoul(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || line < 1 || line > lib.count) {
+        errno = ERANGE;
+        *what = "No such line";
+        return -1;
+    }
+    return remove_row((uint32_t)(line - 1), what);
+}
+
+// Row of the song named by the first len bytes of name
+static int find_song(const char *name, size_t len, uint32_t *row, const char **what) {
+    int found = pif_library_find(&lib, name, len, row);
+    if (found == -1) {
+        *what = "Failed to look up song";
+        return -1;
+    }
+    if (found == 0) {
+        errno = ENOENT;
+        *what = "No such song";
+        return -1;
+    }
+    return 0;
+}
+
+static int run_forget(const char *arg, FILE *out, const char **what) {
+    (void)out;  // Suppress unused parameter warning
+    uint32_t row;
+    if (find_song(arg, strlen(arg), &row, what) == -1) {
+        return -1;
+    }
+    return remove_row(row, what);
+}
+
+static int run_freq(const char *arg, FILE *out, const char **what) {
+    (void)out;  // Suppress unused parameter warning
+    uint32_t name_len, row;
+    int32_t freq;
+    size_t len = strlen(arg);
+    pif_parse_line(arg, len, &name_len, &freq);
+    if (name_len == len || freq == PIF_FREQ_NONE) {
+        errno = EINVAL;
+        *what = "Expected a song and a number of days or rot";
+        return -1;
+    }
+    if (find_song(arg, name_len, &row, what) == -1) {
+        return -1;
+    }
+    off_t journal_size;
+    int stale = pif_journal_append(fileloc, PIF_JOURNAL_REPLACE, row, arg, len, &journal_size);
+    if (stale == -1) {
+        *what = "Failed to write journal";
+        return -1;
+    }
+    warn_stale(stale);
+    if (pif_library_replace(&lib, row, arg, len) == -1) {
+        *what = "Failed to change frequency";
+        lib_stale = 1;
+        memset(lib_sig, 0, sizeof(lib_sig));
+        return -1;
+    }
+    maybe_compact(journal_size);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int takes_arg;
+    int (*run)(const char *arg, FILE *out, const char **what);
+} commands[] = {
+    { "today", 0, run_today },
+    { "rotation", 0, run_rotation },
+    { "due", 0, run_due },
+    { "next-due", 0, run_next_due },
+    { "plan", 1, run_plan },
+    { "practiced", 1, run_practiced },
+    { "add", 1, run_add },
+    { "remove", 1, run_remove },
+    { "forget", 1, run_forget },
+    { "freq", 1, run_freq },
+};
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Read the request line, or fail if the client does not send one in time
+static int read_request(int fd, char *buf, size_t size) {
+    size_t used = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf + used, size - used, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        char *eol = memchr(buf + used, '\n', (size_t)n);
+        used += (size_t)n;
+        if (eol != NULL) {
+            *eol = '\0';
+            return 0;
+        }
+        if (n == 0 || used == size) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+}
+
+static void answer(int fd, const char *request) {
+    char name[32];
+    const char *arg = strchr(request, ' ');
+    size_t name_len = arg != NULL ? (size_t)(arg - request) : strlen(request);
+    arg = arg != NULL ? arg + 1 : "";
+
+    pif_trace_reset();  // Each request gets its own report
+    const char *command = "unknown";
+    int rc = -1;
+    int err = EINVAL;
+    const char *what = "Unknown request";
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = NULL;
+    if (name_len < sizeof(name)) {
+        memcpy(name, request, name_len);
+        name[name_len] = '\0';
+        for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+            if (strcmp(name, commands[i].name) != 0) {
+                continue;
+            }
+            command = commands[i].name;
+            if (commands[i].takes_arg != (arg[0] != '\0')) {
+                what = "Malformed request";
+                break;
+            }
+            if ((out = open_memstream(&body, &body_len)) == NULL) {
+                err = errno;
+                what = "Memory allocation failed";
+                break;
+            }
+            rc = refresh(&what);
+            if (rc == 0) {
+                rc = commands[i].run(arg, out, &what);
+            }
+            err = errno;
+            break;
+        }
+    }
+    if (out != NULL && fclose(out) == EOF && rc == 0) {
+        err = errno;
+        what = "Memory allocation failed";
+        rc = -1;
+    }
+
+    if (rc == 0) {
+        if (send_all(fd, "ok\n", 3) == 0) {
+            send_all(fd, body, body_len);
+        }
+    } else {
+        char status[512];
+        if (err <= 0) {
+            err = EIO;
+        }
+        int len = snprintf(status, sizeof(status), "error %d %s: %s\n", err, what, strerror(err));
+        send_all(fd, status, (size_t)len < sizeof(status) ? (size_t)len : sizeof(status) - 1);
+    }
+    free(body);
+    pif_trace_report(stderr, command);
+}
+
+static void serve(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    // Only the user running the daemon may use it
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 || cred.uid != getuid()) {
+        close(fd);
+        return;
+    }
+
+    // A stalled client must not hold up everyone else
+    struct timeval timeout = { CLIENT_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[PIF_IPC_MAX_REQUEST];
+    if (read_request(fd, request, sizeof(request)) == 0) {
+        answer(fd, request);
+    }
+    close(fd);
+}
+
+// Flag whatever a batch of inotify events touched for reloading
+static void note_changes(int inotify_fd) {
+    const size_t prefix_len = strlen(PRACTICE_FILE_PREFIX);
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return;
+        }
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                lib_stale = practice_stale = 1;
+                continue;
+            }
+            if (ev->len == 0) {
+                continue;
+            }
+            if (strcmp(ev->name, ".pif") == 0 || strcmp(ev->name, ".pif" PIF_JOURNAL_SUFFIX) == 0) {
+                lib_stale = 1;
+            } else if (strcmp(ev->name, PRACTICE_LOG_NAME) == 0 ||
+                       strncmp(ev->name, PRACTICE_FILE_PREFIX, prefix_len) == 0) {
+                practice_stale = 1;
+            }
+        }
+    }
+}
+
+static int listen_socket(const char *path) {
+    // A socket left behind by a daemon that died is stale if nobody answers
+    int probe = pif_ipc_connect(path);
+    if (probe != -1) {
+        close(probe);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    mode_t old_mask = umask(0077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc == -1 || listen(fd, SOMAXCONN) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+static void on_signal(int sig) {
+    (void)sig;  // Suppress unused parameter warning
+    quit = 1;
+}
+
+void usage(void) {
+    fprintf(stderr, "Usage: pifd\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    (void)argv;  // Suppress unused parameter warning
+    if (argc > 1) {
+        usage();
+    }
+    pif_trace_init(PIF_TRACE_OFF, 0);  // PIF_TRACE reports each request on stderr
+
+    struct passwd *info = getpwuid(getuid());
+    if (info == NULL) {
+        handle_error("Failed to get user information");
+    }
+    const char *homedir = info->pw_dir;
+    if (homedir == NULL) {
+        handle_error("Home directory is NULL");
+    }
+
+    size_t len = snprintf(fileloc, sizeof(fileloc), "%s/.pif", homedir);
+    if (len >= sizeof(fileloc)) {
+        handle_error("Path too long");
+    }
+    len = snprintf(configloc, sizeof(configloc), "%s/.pif-config", homedir);
+    if (len >= sizeof(configloc)) {
+        handle_error("Path too long");
+    }
+    len = snprintf(stateloc, sizeof(stateloc), "%s/" PIF_STATE_NAME, homedir);
+    if (len >= sizeof(stateloc)) {
+        handle_error("Path too long");
+    }
+    len = snprintf(journal_loc, sizeof(journal_loc), "%s" PIF_JOURNAL_SUFFIX, fileloc);
+    if (len >= sizeof(journal_loc)) {
+        handle_error("Path too long");
+    }
+    if (pif_state_open(&state, stateloc, configloc) == -1) {
+        handle_error("Failed to open rotation state");
+    }
+
+    // Practice history lives next to the legacy per-song files
+    practice_dir = getenv("HOME") != NULL ? getenv("HOME") : homedir;
+
+    char sockpath[PATH_MAX];
+    if (pif_ipc_socket_path(sockpath, sizeof(sockpath)) == -1) {
+        handle_error("Failed to locate XDG_RUNTIME_DIR");
+    }
+
+    // Watch the directories, since every writer replaces or recreates files
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        handle_error("Failed to watch files");
+    }
+    const uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+    if (inotify_add_watch(inotify_fd, homedir, watch_mask) == -1 ||
+        inotify_add_watch(inotify_fd, practice_dir, watch_mask) == -1) {
+        handle_error("Failed to watch files");
+    }
+
+    // Load up front so the first request is fast; errors resurface then
+    const char *what;
+    if (refresh(&what) == -1) {
+        fprintf(stderr, "Warning: %s: %s\n", what, strerror(errno));
+    }
+
+    int listen_fd = listen_socket(sockpath);
+    if (listen_fd == -1) {
+        handle_error("Failed to listen on socket");
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    struct pollfd fds[2] = {
+        { .fd = listen_fd, .events = POLLIN },
+        { .fd = inotify_fd, .events = POLLIN },
+    };
+    while (!quit) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            handle_error("Failed to wait for requests");
+        }
+        // Events first, so a request sees writes that raced it
+        if (fds[1].revents & POLLIN) {
+            note_changes(inotify_fd);
+        }
+        if (fds[0].revents & POLLIN) {
+            serve(listen_fd);
+        }
+    }
+
+    unlink(sockpath);
+    close(listen_fd);
+    close(inotify_fd);
+    if (lib_loaded) {
+        pif_library_close(&lib);
+    }
+    pif_state_close(&state);
+    return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "pifdb.h"
+#include "libpif.h"
+#include "scan.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int64_t ctime_ns(const struct stat *st) {
+    return (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+}
+
+// Whether the snapshot was built from the text file as it is now. Size and
+// mtime alone miss a same-size rewrite within the mtime granularity, or a
+// file renamed into place with its mtime preserved.
+static int built_from(const struct pifdb_header *hdr, const struct stat *source) {
+    return hdr->source_mtime_ns == mtime_ns(source) && hdr->source_size == (uint64_t)source->st_size &&
+           hdr->source_ino == (uint64_t)source->st_ino && hdr->source_ctime_ns == ctime_ns(source);
+}
+
+static uint64_t sum_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    for (; len > 0; p++, len--) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Checksum of everything that says where a line or rotation song is, so
+// a damaged snapshot is rebuilt rather than read out of bounds. These
+// arrays are read front to back on open anyway; the string table, which
+// is much larger, is not read at all, and pifdb_line checks each line
+// against its bounds instead.
+static uint64_t index_sum(const struct pifdb_header *hdr, const char *base) {
+    uint64_t h = sum_bytes(14695981039346656037ULL, &hdr->strings_len, sizeof(hdr->strings_len));
+    h = sum_bytes(h, base + hdr->line_off, (size_t)hdr->count * sizeof(uint64_t));
+    h = sum_bytes(h, base + hdr->line_len_off, (size_t)hdr->count * sizeof(uint32_t));
+    h = sum_bytes(h, base + hdr->name_len_off, (size_t)hdr->count * sizeof(uint32_t));
+    return sum_bytes(h, base + hdr->rot_index_off, (size_t)hdr->rot_count * sizeof(uint32_t));
+}
+
+// Whether the rotation list and the line arrays can be trusted
+static int check_index(const struct pifdb *db) {
+    const struct pifdb_header *hdr = db->hdr;
+    if (hdr->rot_count > hdr->count || index_sum(hdr, db->base) != hdr->index_sum) {
+        return -1;
+    }
+    for (uint32_t k = 0; k < db->rot_count; k++) {
+        if (db->rot_index[k] >= db->count) {
+            return -1;
+        }
+    }
+
+    // Every line ends in a NUL, so a damaged line still stops inside the table
+    return hdr->strings_len > 0 && db->strings[hdr->strings_len - 1] != '\0' ? -1 : 0;
+}
+
+// Point the section pointers into an image, checking it is self-consistent
+static int attach(struct pifdb *db, void *base, size_t size) {
+    if (size < sizeof(struct pifdb_header)) {
+        return -1;
+    }
+    const struct pifdb_header *hdr = base;
+    if (memcmp(hdr->magic, PIFDB_MAGIC, 4) != 0 || hdr->version != PIFDB_VERSION) {
+        return -1;
+    }
+
+    const struct {
+        uint64_t off;
+        uint64_t len;
+    } sections[] = {
+        { hdr->line_off, (uint64_t)hdr->count * sizeof(uint64_t) },
+        { hdr->last_practice_off, (uint64_t)hdr->count * sizeof(int64_t) },
+        { hdr->line_len_off, (uint64_t)hdr->count * sizeof(uint32_t) },
+        { hdr->name_len_off, (uint64_t)hdr->count * sizeof(uint32_t) },
+        { hdr->freq_off, (uint64_t)hdr->count * sizeof(int32_t) },
+        { hdr->rot_index_off, (uint64_t)hdr->rot_count * sizeof(uint32_t) },
+        { hdr->rot_off, hdr->count },
+        { hdr->strings_off, hdr->strings_len },
+    };
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        if (sections[i].off % 8 != 0 || sections[i].off > size || sections[i].len > size - sections[i].off) {
+            return -1;
+        }
+    }
+
+    char *p = base;
+    db->base = base;
+    db->size = size;
+    db->hdr = hdr;
+    db->line_off = (const uint64_t *)(p + hdr->line_off);
+    db->last_practice = (int64_t *)(p + hdr->last_practice_off);
+    db->line_len = (const uint32_t *)(p + hdr->line_len_off);
+    db->name_len = (const uint32_t *)(p + hdr->name_len_off);
+    db->freq = (const int32_t *)(p + hdr->freq_off);
+    db->rot_index = (const uint32_t *)(p + hdr->rot_index_off);
+    db->rot = (const uint8_t *)(p + hdr->rot_off);
+    db->strings = p + hdr->strings_off;
+    db->count = hdr->count;
+    db->rot_count = hdr->rot_count;
+    return 0;
+}
+
+// Map an existing snapshot if it was built from exactly this text file
+static int map_snapshot(struct pifdb *db, const char *dbloc, const struct stat *source) {
+    int writable = 1;
+    int fd = open(dbloc, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        writable = 0;
+        fd = open(dbloc, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return -1;
+        }
+    }
+
+    struct stat st;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct pifdb_header)) {
+        close(fd);
+        return -1;
+    }
+
+    // Stale last-practice entries are refreshed in place, so map writable
+    size_t size = (size_t)st.st_size;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    // A stale or damaged snapshot is treated as missing
+    if (attach(db, base, size) == -1 || !built_from(db->hdr, source) || check_index(db) == -1) {
+        munmap(base, size);
+        memset(db, 0, sizeof(*db));
+        return -1;
+    }
+    db->mapped = 1;
+    return 0;
+}
+
+// Build a snapshot image in memory from the text file open on fd
+static int build_snapshot(struct pifdb *db, int fd, const struct stat *source,
+                          struct practice_source *practice) {
+    size_t text_len = (size_t)source->st_size;
+    const char *text = NULL;
+    if (text_len > 0) {
+        text = mmap(NULL, text_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            return -1;
+        }
+        madvise((void *)text, text_len, MADV_SEQUENTIAL);
+    }
+
+    // Size every section up front so the image is a single allocation
+    size_t newlines = text_len > 0 ? scan_count_newlines(text, text_len) : 0;
+    size_t count = newlines;
+    if (text_len > 0 && text[text_len - 1] != '\n') {
+        count++;  // Last line has no trailing newline
+    }
+    if (count > UINT32_MAX) {
+        if (text != NULL) {
+            munmap((void *)text, text_len);
+        }
+        errno = EFBIG;
+        return -1;
+    }
+
+    struct pifdb_header hdr = { .version = PIFDB_VERSION };
+    memcpy(hdr.magic, PIFDB_MAGIC, 4);
+    hdr.source_mtime_ns = mtime_ns(source);
+    hdr.source_size = (uint64_t)source->st_size;
+    hdr.source_ino = (uint64_t)source->st_ino;
+    hdr.source_ctime_ns = ctime_ns(source);
+    hdr.count = (uint32_t)count;
+
+    size_t off = align8(sizeof(hdr));
+    hdr.line_off = off;
+    off += align8(count * sizeof(uint64_t));
+    hdr.last_practice_off = off;
+    off += align8(count * sizeof(int64_t));
+    hdr.line_len_off = off;
+    off += align8(count * sizeof(uint32_t));
+    hdr.name_len_off = off;
+    off += align8(count * sizeof(uint32_t));
+    hdr.freq_off = off;
+    off += align8(count * sizeof(int32_t));
+    hdr.rot_index_off = off;
+    off += align8(count * sizeof(uint32_t));  // Sized for every line being rot
+    hdr.rot_off = off;
+    off += align8(count);
+    hdr.strings_off = off;
+    hdr.strings_len = text_len - newlines + count;
+    off += align8(hdr.strings_len);
+
+    char *image = calloc(1, off);
+    if (image == NULL) {
+        if (text != NULL) {
+            munmap((void *)text, text_len);
+        }
+        return -1;
+    }
+
+    uint64_t *line_off = (uint64_t *)(image + hdr.line_off);
+    uint32_t *line_len = (uint32_t *)(image + hdr.line_len_off);
+    uint32_t *name_len = (uint32_t *)(image + hdr.name_len_off);
+    int32_t *freq = (int32_t *)(image + hdr.freq_off);
+    uint32_t *rot_index = (uint32_t *)(image + hdr.rot_index_off);
+    uint8_t *rot = (uint8_t *)(image + hdr.rot_off);
+    char *strings = image + hdr.strings_off;
+
+    // The strings table is the file with each newline turned into a NUL,
+    // so scanned offsets index it directly
+    if (text_len > 0) {
+        memcpy(strings, text, text_len);
+        scan_lines(text, text_len, line_off, line_len, name_len);
+    }
+    uint32_t rot_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const char *line = strings + line_off[i];
+        strings[line_off[i] + line_len[i]] = '\0';
+        int32_t f = name_len[i] == line_len[i]
+                        ? PIF_FREQ_NONE
+                        : pif_parse_freq(line + name_len[i] + 1, line_len[i] - name_len[i] - 1);
+        if (f == PIF_FREQ_ROT) {
+            rot[i] = 1;
+            rot_index[rot_count++] = i;
+        } else {
+            freq[i] = f;
+        }
+    }
+    hdr.rot_count = rot_count;
+    hdr.index_sum = index_sum(&hdr, image);
+    memcpy(image, &hdr, sizeof(hdr));
+
+    if (text != NULL) {
+        munmap((void *)text, text_len);
+    }
+
+    attach(db, image, off);
+    db->mapped = 0;
+
+    // Fill in last-practiced times for every frequency song in one batch
+    if (practice == NULL) {
+        return 0;
+    }
+    struct practice_query *queries = calloc(count ? count : 1, sizeof(*queries));
+    uint32_t *songs = calloc(count ? count : 1, sizeof(*songs));
+    if (queries == NULL || songs == NULL) {
+        free(queries);
+        free(songs);
+        pifdb_close(db);
+        return -1;
+    }
+    size_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (freq[i] > 0) {
+            queries[n] = (struct practice_query){ pifdb_line(db, i), name_len[i], 0 };
+            songs[n++] = i;
+        }
+    }
+    int rc = practice_source_lookup(practice, queries, n);
+    for (size_t k = 0; rc == 0 && k < n; k++) {
+        db->last_practice[songs[k]] = queries[k].when;
+    }
+    free(queries);
+    free(songs);
+    if (rc == -1) {
+        pifdb_close(db);
+    }
+    return rc;
+}
+
+// Atomically replace the snapshot on disk with the in-memory image
+static int write_snapshot(const struct pifdb *db, const char *dbloc) {
+    char temp_path[PATH_MAX];
+    int len = snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", dbloc);
+    if (len < 0 || (size_t)len >= sizeof(temp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        return -1;
+    }
+
+    const char *p = db->base;
+    size_t left = db->size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            unlink(temp_path);
+            return -1;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+
+    if (close(fd) == -1 || rename(temp_path, dbloc) == -1) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int open_db(struct pifdb *db, const char *fileloc, struct practice_source *practice, int reuse) {
+    memset(db, 0, sizeof(*db));
+
+    char dbloc[PATH_MAX];
+    int len = snprintf(dbloc, sizeof(dbloc), "%sdb", fileloc);
+    if (len < 0 || (size_t)len >= sizeof(dbloc)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open(fileloc, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    if (reuse && map_snapshot(db, dbloc, &st) == 0) {
+        close(fd);
+        return 0;
+    }
+
+    int rc = build_snapshot(db, fd, &st, practice);
+    int saved = errno;
+    close(fd);
+    if (rc == -1) {
+        errno = saved;
+        return -1;
+    }
+
+    // A read-only home still gets a working in-memory snapshot
+    write_snapshot(db, dbloc);
+    return 0;
+}
+
+int pifdb_open(struct pifdb *db, const char *fileloc, struct practice_source *practice) {
+    return open_db(db, fileloc, practice, 1);
+}
+
+int pifdb_rebuild(struct pifdb *db, const char *fileloc, struct practice_source *practice) {
+    return open_db(db, fileloc, practice, 0);
+}
+
+void pifdb_close(struct pifdb *db) {
+    if (db->base != NULL) {
+        if (db->mapped) {
+            munmap(db->base, db->size);
+        } else {
+            free(db->base);
+        }
+    }
+    memset(db, 0, sizeof(*db));
+}
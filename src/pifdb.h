@@ -0,0 +1,110 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIFDB_H
+#define PIFDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "practice.h"
+
+// Binary snapshot of ~/.pif, kept next to it as ~/.pifdb.
+//
+// Layout: a fixed header followed by parallel arrays with one entry per
+// line of the text file, then the list of rotation songs and a string
+// table holding every line NUL-terminated. All sections are 8-byte aligned
+// so the file can be used in place after mmap.
+#define PIFDB_MAGIC "PIFD"
+#define PIFDB_VERSION 3
+
+struct pifdb_header {
+    char magic[4];
+    uint32_t version;
+    int64_t source_mtime_ns;     // mtime of ~/.pif this was built from
+    uint64_t source_size;        // size of ~/.pif this was built from
+    uint64_t source_ino;         // inode of ~/.pif this was built from
+    int64_t source_ctime_ns;     // ctime of ~/.pif this was built from
+    uint32_t count;              // number of lines
+    uint32_t rot_count;          // number of rotation songs
+    uint64_t line_off;           // uint64_t[count], offset into strings
+    uint64_t last_practice_off;  // int64_t[count], 0 if never practiced
+    uint64_t line_len_off;       // uint32_t[count], line length
+    uint64_t name_len_off;       // uint32_t[count], length up to the last space
+    uint64_t freq_off;           // int32_t[count], days, 0 if rot or invalid
+    uint64_t rot_index_off;      // uint32_t[rot_count], rotation songs in order
+    uint64_t rot_off;            // uint8_t[count], 1 for rotation songs
+    uint64_t strings_off;
+    uint64_t strings_len;
+    uint64_t index_sum;  // Checksum of the arrays locating lines and rotation songs
+};
+
+struct pifdb {
+    void *base;
+    size_t size;
+    int mapped;  // 1 if base is an mmap of the snapshot, 0 if malloc'd
+    const struct pifdb_header *hdr;
+    const char *strings;
+    const uint64_t *line_off;
+    int64_t *last_practice;
+    const uint32_t *line_len;
+    const uint32_t *name_len;
+    const int32_t *freq;
+    const uint32_t *rot_index;
+    const uint8_t *rot;
+    uint32_t count;
+    uint32_t rot_count;
+};
+
+// Open the snapshot for fileloc, rebuilding it when it is missing or does
+// not match the text file. A rebuild fills in last-practiced times from
+// practice, if given. If the snapshot cannot be written the rebuilt image
+// is still returned from memory. Returns 0 on success or -1 with errno set.
+int pifdb_open(struct pifdb *db, const char *fileloc, struct practice_source *practice);
+
+// Like pifdb_open, but always rebuild from the text file, for a snapshot
+// found to be damaged after it was opened
+int pifdb_rebuild(struct pifdb *db, const char *fileloc, struct practice_source *practice);
+void pifdb_close(struct pifdb *db);
+
+// Whole line, NUL-terminated, or NULL if entry i does not lie inside the
+// string table. Opening checks the index arrays against their checksum
+// but leaves the strings alone, so each line is checked here, without
+// touching its page, as it is first used.
+static inline const char *pifdb_line(const struct pifdb *db, uint32_t i) {
+    uint64_t off = db->line_off[i];
+    uint64_t strings_len = db->hdr->strings_len;
+    if (off >= strings_len || db->line_len[i] >= strings_len - off || db->name_len[i] > db->line_len[i]) {
+        return NULL;
+    }
+    return db->strings + off;
+}
+
+// Frequency text after the last space, or an empty span if there is none.
+// Entry i must be one pifdb_line accepts.
+static inline const char *pifdb_freq_text(const struct pifdb *db, uint32_t i, size_t *len) {
+    uint32_t name_len = db->name_len[i];
+    if (name_len == db->line_len[i]) {
+        *len = 0;
+        return pifdb_line(db, i) + name_len;
+    }
+    *len = db->line_len[i] - name_len - 1;
+    return pifdb_line(db, i) + name_len + 1;
+}
+
+#endif
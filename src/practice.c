@@ -0,0 +1,533 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "practice.h"
+#include "batchstat.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// FNV-1a, which is plenty for song names
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct practice_entry *find_slot(struct practice_entry *slots, size_t capacity,
+                                        const char *name, size_t len, uint64_t hash) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct practice_entry *slot = &slots[i];
+        if (slot->name == NULL ||
+            (slot->hash == hash && slot->name_len == len && memcmp(slot->name, name, len) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static int grow(struct practice_log *log) {
+    size_t capacity = log->capacity ? log->capacity * 2 : 1024;
+    struct practice_entry *slots = log->arena != NULL ? pif_arena_calloc(log->arena, capacity, sizeof(*slots))
+                                                      : calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < log->capacity; i++) {
+        struct practice_entry *old = &log->slots[i];
+        if (old->name != NULL) {
+            *find_slot(slots, capacity, old->name, old->name_len, old->hash) = *old;
+        }
+    }
+    if (log->arena == NULL) {
+        free(log->slots);
+    }
+    log->slots = slots;
+    log->capacity = capacity;
+    return 0;
+}
+
+static int record(struct practice_log *log, const char *name, size_t len, int64_t when) {
+    // Keep the table at most 70% full
+    if ((log->used + 1) * 10 > log->capacity * 7 && grow(log) == -1) {
+        return -1;
+    }
+    uint64_t hash = hash_name(name, len);
+    struct practice_entry *slot = find_slot(log->slots, log->capacity, name, len, hash);
+    if (slot->name == NULL) {
+        slot->name = name;
+        slot->name_len = (uint32_t)len;
+        slot->hash = hash;
+        slot->when = when;
+        log->used++;
+    } else if (when > slot->when) {
+        slot->when = when;
+    }
+    return 0;
+}
+
+int practice_log_open(struct practice_log *log, const char *path, struct pif_arena *arena) {
+    memset(log, 0, sizeof(*log));
+    log->arena = arena;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if (grow(log) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    log->map_len = (size_t)st.st_size;
+    log->map = mmap(NULL, log->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (log->map == MAP_FAILED) {
+        log->map = NULL;
+        practice_log_close(log);
+        return -1;
+    }
+    madvise(log->map, log->map_len, MADV_SEQUENTIAL);
+
+    const char *p = log->map;
+    const char *end = log->map + log->map_len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            break;  // Ignore a record that is still being appended
+        }
+
+        // "<unix time> <song>"
+        int64_t when = 0;
+        const char *q = p;
+        while (q < eol && *q >= '0' && *q <= '9') {
+            when = when * 10 + (*q++ - '0');
+        }
+        if (q > p && q < eol && *q == ' ' && eol > q + 1) {
+            if (record(log, q + 1, eol - (q + 1), when) == -1) {
+                practice_log_close(log);
+                return -1;
+            }
+            log->records++;
+        }
+        p = eol + 1;
+    }
+    return 0;
+}
+
+void practice_log_close(struct practice_log *log) {
+    if (log->arena == NULL) {
+        free(log->slots);
+    }
+    if (log->map != NULL) {
+        munmap(log->map, log->map_len);
+    }
+    memset(log, 0, sizeof(*log));
+}
+
+int64_t practice_log_last(const struct practice_log *log, const char *name, size_t name_len) {
+    if (log->capacity == 0) {
+        return 0;
+    }
+    const struct practice_entry *slot =
+        find_slot(log->slots, log->capacity, name, name_len, hash_name(name, name_len));
+    return slot->name != NULL ? slot->when : 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Open and lock the log, retrying if a compaction renamed a new log over
+// it between the open and the lock. Migration, appends and compaction all
+// hold this lock; readers map the log without it.
+static int open_locked(const char *path) {
+    for (;;) {
+        int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            return -1;
+        }
+        while (flock(fd, LOCK_EX) == -1) {
+            if (errno != EINTR) {
+                int saved = errno;
+                close(fd);
+                errno = saved;
+                return -1;
+            }
+        }
+
+        struct stat fd_st, path_st;
+        pif_trace_stats(2);
+        if (fstat(fd, &fd_st) == 0 && stat(path, &path_st) == 0 &&
+            fd_st.st_dev == path_st.st_dev && fd_st.st_ino == path_st.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+static int append_record(int fd, const char *name, size_t name_len, int64_t when) {
+    if (name_len == 0 || memchr(name, '\n', name_len) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // One write per record so a reader never sees half of one
+    char stack_buf[512];
+    size_t max = name_len + 32;
+    char *buf = max <= sizeof(stack_buf) ? stack_buf : malloc(max);
+    if (buf == NULL) {
+        return -1;
+    }
+    int len = snprintf(buf, max, "%lld %.*s\n", (long long)when, (int)name_len, name);
+    int rc = write_all(fd, buf, (size_t)len);
+    int saved = errno;
+    if (buf != stack_buf) {
+        free(buf);
+    }
+    errno = saved;
+    return rc;
+}
+
+// Close a locked log, which releases the lock
+static int close_locked(int fd, int rc) {
+    int saved = errno;
+    if (close(fd) == -1 && rc != -1) {
+        return -1;
+    }
+    errno = saved;
+    return rc;
+}
+
+int practice_log_append(const char *path, const char *name, size_t name_len, int64_t when) {
+    int fd = open_locked(path);
+    if (fd == -1) {
+        return -1;
+    }
+    return close_locked(fd, append_record(fd, name, name_len, when));
+}
+
+// Write a whole buffer to path through a temp file in the same directory
+static int replace_file(const char *path, const char *buf, size_t len) {
+    char temp_path[PATH_MAX];
+    int n = snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    if (n < 0 || (size_t)n >= sizeof(temp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(temp_path);
+    if (fd == -1) {
+        return -1;
+    }
+    if (write_all(fd, buf, len) == -1 || fsync(fd) == -1) {
+        int saved = errno;
+        close(fd);
+        unlink(temp_path);
+        errno = saved;
+        return -1;
+    }
+    if (close(fd) == -1 || rename(temp_path, path) == -1) {
+        int saved = errno;
+        unlink(temp_path);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+// Call with the log locked, so no record is appended to the old file
+// after it was read
+static int compact_locked(const char *path) {
+    struct practice_log log;
+    if (practice_log_open(&log, path, NULL) == -1) {
+        return -1;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < log.capacity; i++) {
+        if (log.slots[i].name != NULL) {
+            size += log.slots[i].name_len + 22;
+        }
+    }
+
+    char *buf = malloc(size + 1);
+    if (buf == NULL) {
+        practice_log_close(&log);
+        return -1;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < log.capacity; i++) {
+        const struct practice_entry *e = &log.slots[i];
+        if (e->name != NULL) {
+            len += (size_t)snprintf(buf + len, size + 1 - len, "%lld %.*s\n",
+                                    (long long)e->when, (int)e->name_len, e->name);
+        }
+    }
+
+    int rc = replace_file(path, buf, len);
+    int saved = errno;
+    free(buf);
+    practice_log_close(&log);
+    errno = saved;
+    return rc;
+}
+
+int practice_log_compact(const char *path) {
+    int fd = open_locked(path);
+    if (fd == -1) {
+        return -1;
+    }
+    return close_locked(fd, compact_locked(path));
+}
+
+// Append the mtimes of the legacy files in dir to the locked log fd
+static long migrate_locked(int fd, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+
+    const size_t prefix_len = strlen(PRACTICE_FILE_PREFIX);
+    char *buf = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    long imported = 0;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strncmp(ent->d_name, PRACTICE_FILE_PREFIX, prefix_len) != 0 || ent->d_name[prefix_len] == '\0') {
+            continue;
+        }
+        struct stat st;
+        pif_trace_stats(1);
+        if (fstatat(dirfd(d), ent->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        const char *name = ent->d_name + prefix_len;
+        size_t need = strlen(name) + 32;
+        if (len + need > capacity) {
+            size_t grown = capacity ? capacity * 2 : 4096;
+            while (grown < len + need) {
+                grown *= 2;
+            }
+            char *p = realloc(buf, grown);
+            if (p == NULL) {
+                free(buf);
+                closedir(d);
+                return -1;
+            }
+            buf = p;
+            capacity = grown;
+        }
+        len += (size_t)snprintf(buf + len, capacity - len, "%lld %s\n", (long long)st.st_mtime, name);
+        imported++;
+    }
+    closedir(d);
+
+    // Imported records go in with a single append
+    int rc = len > 0 && (write_all(fd, buf, len) == -1 || fsync(fd) == -1) ? -1 : 0;
+    int saved = errno;
+    free(buf);
+    errno = saved;
+    return rc == -1 ? -1 : imported;
+}
+
+long practice_log_migrate(const char *path, const char *dir) {
+    // Opening the log creates it, so the new layout is used from now on
+    // even when there is nothing to import
+    int fd = open_locked(path);
+    if (fd == -1) {
+        return -1;
+    }
+    long imported = migrate_locked(fd, dir);
+    int saved = errno;
+    if (close(fd) == -1 && imported != -1) {
+        return -1;
+    }
+    errno = saved;
+    return imported;
+}
+
+static int record_practice(const char *dir, const char *name, size_t name_len, int64_t when) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/" PRACTICE_LOG_NAME, dir);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = open_locked(path);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // First use of the log: carry over the old per-song files. Whoever gets
+    // the lock first does it; everyone after finds records in the log.
+    struct stat st;
+    pif_trace_stats(1);
+    if (fstat(fd, &st) == -1 || (st.st_size == 0 && migrate_locked(fd, dir) == -1) ||
+        append_record(fd, name, name_len, when) == -1) {
+        return close_locked(fd, -1);
+    }
+
+    // Keep the log from growing without bound
+    struct practice_log log;
+    int rc = 0;
+    if (practice_log_open(&log, path, NULL) == 0) {
+        int full = log.records >= 2 * log.used + 1024;
+        practice_log_close(&log);
+        if (full) {
+            rc = compact_locked(path);
+        }
+    }
+    return close_locked(fd, rc);
+}
+
+int practice_record(const char *dir, const char *name, size_t name_len, int64_t when) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = record_practice(dir, name, name_len, when);
+    pif_trace_end(&span, PIF_PHASE_SAVE);
+    return rc;
+}
+
+void practice_source_init(struct practice_source *src, const char *dir) {
+    memset(src, 0, sizeof(*src));
+    src->dir = dir;
+}
+
+void practice_source_close(struct practice_source *src) {
+    if (src->state == 1) {
+        practice_log_close(&src->log);
+    }
+    src->state = 0;
+}
+
+int practice_source_lookup(struct practice_source *src, struct practice_query *queries, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+
+    if (src->state == 0) {
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/" PRACTICE_LOG_NAME, src->dir);
+        if (len >= 0 && (size_t)len < sizeof(path) && practice_log_open(&src->log, path, src->arena) == 0) {
+            src->state = 1;
+        } else {
+            src->state = -1;
+        }
+    }
+    if (src->state == 1) {
+        for (size_t k = 0; k < n; k++) {
+            queries[k].when = practice_log_last(&src->log, queries[k].name, queries[k].name_len);
+        }
+        return 0;
+    }
+
+    // All paths share one buffer: "<dir>/.pif_last_practice_<song>\0" each
+    size_t dir_len = strlen(src->dir);
+    size_t prefix_len = dir_len + 1 + strlen(PRACTICE_FILE_PREFIX);
+    size_t total = 0;
+    for (size_t k = 0; k < n; k++) {
+        total += prefix_len + queries[k].name_len + 1;
+    }
+
+    char *buf;
+    const char **paths;
+    int64_t *mtimes;
+    if (src->arena != NULL) {
+        buf = pif_arena_alloc(src->arena, total);
+        paths = pif_arena_alloc(src->arena, n * sizeof(*paths));
+        mtimes = pif_arena_alloc(src->arena, n * sizeof(*mtimes));
+    } else {
+        buf = malloc(total);
+        paths = malloc(n * sizeof(*paths));
+        mtimes = malloc(n * sizeof(*mtimes));
+    }
+    if (buf == NULL || paths == NULL || mtimes == NULL) {
+        if (src->arena == NULL) {
+            free(buf);
+            free(paths);
+            free(mtimes);
+        }
+        return -1;
+    }
+
+    char *p = buf;
+    for (size_t k = 0; k < n; k++) {
+        paths[k] = p;
+        memcpy(p, src->dir, dir_len);
+        p[dir_len] = '/';
+        memcpy(p + dir_len + 1, PRACTICE_FILE_PREFIX, prefix_len - dir_len - 1);
+        memcpy(p + prefix_len, queries[k].name, queries[k].name_len);
+        p += prefix_len + queries[k].name_len;
+        *p++ = '\0';
+    }
+
+    int rc = batch_mtime(paths, n, mtimes);
+    if (rc == 0) {
+        for (size_t k = 0; k < n; k++) {
+            queries[k].when = mtimes[k];
+        }
+    }
+
+    if (src->arena == NULL) {
+        free(buf);
+        free(paths);
+        free(mtimes);
+    }
+    return rc;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PRACTICE_H
+#define PRACTICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Practice history lives in one append-only log, ~/.pif_practice, with a
+// "<unix time> <song>\n" record per practice session. It replaces the
+// older layout of one ~/.pif_last_practice_<song> file per song, whose
+// mtime was the last practice time. Writers hold an exclusive flock on the
+// log, and compaction renames a new log over it.
+#define PRACTICE_LOG_NAME ".pif_practice"
+#define PRACTICE_FILE_PREFIX ".pif_last_practice_"
+
+struct practice_entry {
+    const char *name;  // Points into the mapped log
+    uint32_t name_len;
+    uint64_t hash;
+    int64_t when;
+};
+
+struct practice_log {
+    char *map;
+    size_t map_len;
+    struct practice_entry *slots;
+    size_t capacity;  // Power of two
+    size_t used;      // Distinct songs
+    size_t records;   // Records in the log, including superseded ones
+    struct pif_arena *arena;  // Where slots come from, NULL for malloc
+};
+
+// Read the whole log in one pass and index the latest time per song.
+// The index is allocated from arena if it is not NULL. Returns 0 on
+// success or -1 with errno set (ENOENT if there is no log).
+int practice_log_open(struct practice_log *log, const char *path, struct pif_arena *arena);
+void practice_log_close(struct practice_log *log);
+
+// Last practice time of a song, or 0 if it has never been practiced
+int64_t practice_log_last(const struct practice_log *log, const char *name, size_t name_len);
+
+// Append one record. Returns 0 on success or -1 with errno set.
+int practice_log_append(const char *path, const char *name, size_t name_len, int64_t when);
+
+// Rewrite the log with only the latest record per song. Returns 0 on
+// success or -1 with errno set.
+int practice_log_compact(const char *path);
+
+// Import the mtimes of every legacy practice file in dir into the log.
+// Returns the number of songs imported or -1 with errno set.
+long practice_log_migrate(const char *path, const char *dir);
+
+// Record that a song was practiced at when in the log in dir, importing
+// the legacy files on first use and compacting the log once most of it
+// is superseded. Returns 0 on success or -1 with errno set.
+int practice_record(const char *dir, const char *name, size_t name_len, int64_t when);
+
+// Where last-practiced times come from: the log in dir when there is one,
+// otherwise the legacy per-song files in dir
+struct practice_source {
+    const char *dir;
+    struct practice_log log;
+    int state;  // 0 not opened yet, 1 using the log, -1 using legacy files
+    struct pif_arena *arena;  // For the log's index and lookups, NULL for malloc
+};
+
+struct practice_query {
+    const char *name;
+    size_t name_len;
+    int64_t when;  // Filled in, 0 if never practiced
+};
+
+void practice_source_init(struct practice_source *src, const char *dir);
+void practice_source_close(struct practice_source *src);
+
+// Answer a batch of lookups. Without a log every lookup is a stat(), so
+// they are all issued together. Returns 0 on success or -1 with errno set.
+int practice_source_lookup(struct practice_source *src, struct practice_query *queries, size_t n);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scan.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#define NO_SPACE SIZE_MAX
+
+struct scan_state {
+    uint64_t *off;
+    uint32_t *line_len;
+    uint32_t *name_len;
+    size_t count;
+    size_t line_start;
+    size_t last_space;  // NO_SPACE if the current line has none yet
+};
+
+static inline void emit(struct scan_state *s, size_t end) {
+    size_t len = end - s->line_start;
+    s->off[s->count] = s->line_start;
+    s->line_len[s->count] = (uint32_t)len;
+    s->name_len[s->count] = (uint32_t)(s->last_space != NO_SPACE ? s->last_space - s->line_start : len);
+    s->count++;
+    s->line_start = end + 1;
+    s->last_space = NO_SPACE;
+}
+
+// Consume one 64-byte block given as newline and space bitmasks
+static inline void scan_masks(struct scan_state *s, size_t base, uint64_t nl, uint64_t sp) {
+    while (nl != 0) {
+        unsigned bit = (unsigned)__builtin_ctzll(nl);
+        uint64_t before = sp & ((UINT64_C(1) << bit) - 1);
+        if (before != 0) {
+            s->last_space = base + 63 - (unsigned)__builtin_clzll(before);
+        }
+        emit(s, base + bit);
+        sp &= ~((UINT64_C(2) << bit) - 1);
+        nl &= nl - 1;
+    }
+    if (sp != 0) {
+        s->last_space = base + 63 - (unsigned)__builtin_clzll(sp);
+    }
+}
+
+static size_t scan_tail(struct scan_state *s, const char *text, size_t from, size_t len) {
+    for (size_t i = from; i < len; i++) {
+        if (text[i] == '\n') {
+            emit(s, i);
+        } else if (text[i] == ' ') {
+            s->last_space = i;
+        }
+    }
+    if (s->line_start < len) {
+        emit(s, len);  // Last line has no trailing newline
+    }
+    return s->count;
+}
+
+static size_t count_tail(const char *text, size_t from, size_t len) {
+    size_t n = 0;
+    for (size_t i = from; i < len; i++) {
+        n += text[i] == '\n';
+    }
+    return n;
+}
+
+static size_t scan_lines_scalar(const char *text, size_t len, uint64_t *off, uint32_t *line_len,
+                                uint32_t *name_len) {
+    struct scan_state s = { off, line_len, name_len, 0, 0, NO_SPACE };
+    return scan_tail(&s, text, 0, len);
+}
+
+static size_t count_newlines_scalar(const char *text, size_t len) {
+    // glibc's memchr is already vectorized
+    size_t n = 0;
+    for (const char *p = text, *end = text + len; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        n++;
+    }
+    return n;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2"))) static inline uint64_t mask16(const char *p, __m128i c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), c));
+}
+
+__attribute__((target("sse2"))) static size_t scan_lines_sse2(const char *text, size_t len, uint64_t *off,
+                                                              uint32_t *line_len, uint32_t *name_len) {
+    struct scan_state s = { off, line_len, name_len, 0, 0, NO_SPACE };
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        const char *p = text + i;
+        uint64_t nl = mask16(p, newline) | mask16(p + 16, newline) << 16 | mask16(p + 32, newline) << 32 |
+                      mask16(p + 48, newline) << 48;
+        uint64_t sp = mask16(p, space) | mask16(p + 16, space) << 16 | mask16(p + 32, space) << 32 |
+                      mask16(p + 48, space) << 48;
+        scan_masks(&s, i, nl, sp);
+    }
+    return scan_tail(&s, text, i, len);
+}
+
+__attribute__((target("sse2"))) static size_t count_newlines_sse2(const char *text, size_t len) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 16 <= len; i += 16) {
+        n += (size_t)__builtin_popcount((unsigned)mask16(text + i, newline));
+    }
+    return n + count_tail(text, i, len);
+}
+
+__attribute__((target("avx2"))) static inline uint64_t mask32(const char *p, __m256i c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), c));
+}
+
+__attribute__((target("avx2"))) static size_t scan_lines_avx2(const char *text, size_t len, uint64_t *off,
+                                                              uint32_t *line_len, uint32_t *name_len) {
+    struct scan_state s = { off, line_len, name_len, 0, 0, NO_SPACE };
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space = _mm256_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        const char *p = text + i;
+        uint64_t nl = mask32(p, newline) | mask32(p + 32, newline) << 32;
+        uint64_t sp = mask32(p, space) | mask32(p + 32, space) << 32;
+        scan_masks(&s, i, nl, sp);
+    }
+    return scan_tail(&s, text, i, len);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t count_newlines_avx2(const char *text, size_t len) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t n = 0, i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint64_t nl = mask32(text + i, newline) | mask32(text + i + 32, newline) << 32;
+        n += (size_t)__builtin_popcountll(nl);
+    }
+    return n + count_tail(text, i, len);
+}
+
+#endif
+
+typedef size_t (*scan_lines_fn)(const char *, size_t, uint64_t *, uint32_t *, uint32_t *);
+typedef size_t (*count_newlines_fn)(const char *, size_t);
+
+static _Atomic(scan_lines_fn) scan_lines_impl;
+static _Atomic(count_newlines_fn) count_newlines_impl;
+
+// Pick the widest implementation this CPU runs. Threads such as those of
+// pif --batch may race to do it; they all store the same pointers, and
+// relaxed atomics are enough since the code they point to never changes.
+static void resolve(void) {
+    scan_lines_fn lines = scan_lines_scalar;
+    count_newlines_fn count = count_newlines_scalar;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        lines = scan_lines_avx2;
+        count = count_newlines_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        lines = scan_lines_sse2;
+        count = count_newlines_sse2;
+    }
+#endif
+    atomic_store_explicit(&scan_lines_impl, lines, memory_order_relaxed);
+    atomic_store_explicit(&count_newlines_impl, count, memory_order_relaxed);
+}
+
+size_t scan_count_newlines(const char *text, size_t len) {
+    count_newlines_fn count = atomic_load_explicit(&count_newlines_impl, memory_order_relaxed);
+    if (count == NULL) {
+        resolve();
+        count = atomic_load_explicit(&count_newlines_impl, memory_order_relaxed);
+    }
+    return count(text, len);
+}
+
+size_t scan_lines(const char *text, size_t len, uint64_t *off, uint32_t *line_len, uint32_t *name_len) {
+    scan_lines_fn lines = atomic_load_explicit(&scan_lines_impl, memory_order_relaxed);
+    if (lines == NULL) {
+        resolve();
+        lines = atomic_load_explicit(&scan_lines_impl, memory_order_relaxed);
+    }
+    return lines(text, len, off, line_len, name_len);
+}
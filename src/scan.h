@@ -0,0 +1,39 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Block scanner for the "name freq" line format. Newlines and spaces are
+// found 16 or 32 bytes at a time (SSE2 or AVX2, picked at run time) with
+// a scalar fallback elsewhere, so a whole library is split into lines and
+// name/frequency spans in one pass without copying.
+
+// Number of '\n' bytes in text
+size_t scan_count_newlines(const char *text, size_t len);
+
+// Split text into lines. For line i, off[i] is its start, line_len[i] its
+// length without the newline and name_len[i] the length up to its last
+// space, or line_len[i] if it has none. A last line without a trailing
+// newline counts. The arrays must have room for every line. Returns the
+// number of lines.
+size_t scan_lines(const char *text, size_t len, uint64_t *off, uint32_t *line_len, uint32_t *name_len);
+
+#endif
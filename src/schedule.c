@@ -0,0 +1,202 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "schedule.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void due_heap_free(struct due_heap *heap) {
+    struct pif_arena *arena = heap->arena;
+    if (arena == NULL) {
+        free(heap->entries);
+        free(heap->pos);
+    }
+    memset(heap, 0, sizeof(*heap));
+    heap->arena = arena;
+}
+
+static void *alloc(const struct due_heap *heap, size_t size) {
+    return heap->arena != NULL ? pif_arena_alloc(heap->arena, size) : malloc(size);
+}
+
+static void place(struct due_heap *heap, uint32_t i, struct due_entry entry) {
+    heap->entries[i] = entry;
+    heap->pos[entry.id] = i;
+}
+
+static void sift_up(struct due_heap *heap, uint32_t i) {
+    struct due_entry moving = heap->entries[i];
+    while (i > 0 && heap->entries[(i - 1) / 2].when > moving.when) {
+        place(heap, i, heap->entries[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(heap, i, moving);
+}
+
+static void sift_down(struct due_heap *heap, uint32_t i) {
+    struct due_entry *e = heap->entries;
+    struct due_entry moving = e[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && e[child + 1].when < e[child].when) {
+            child++;
+        }
+        if (e[child].when >= moving.when) {
+            break;
+        }
+        place(heap, i, e[child]);
+        i = child;
+    }
+    place(heap, i, moving);
+}
+
+int due_heap_build(struct due_heap *heap, const struct due_entry *entries, uint32_t count, uint32_t ids) {
+    struct due_entry *copy = alloc(heap, (count ? count : 1) * sizeof(*copy));
+    uint32_t *pos = alloc(heap, (ids ? ids : 1) * sizeof(*pos));
+    if (copy == NULL || pos == NULL) {
+        if (heap->arena == NULL) {
+            free(copy);
+            free(pos);
+        }
+        return -1;
+    }
+    due_heap_free(heap);
+    heap->entries = copy;
+    heap->count = count;
+    heap->capacity = count ? count : 1;
+    heap->pos = pos;
+    heap->ids = ids;
+    memset(pos, 0xff, ids * sizeof(*pos));
+    for (uint32_t i = 0; i < count; i++) {
+        place(heap, i, entries[i]);
+    }
+    for (uint32_t i = count / 2; i-- > 0;) {
+        sift_down(heap, i);
+    }
+    return 0;
+}
+
+int due_heap_collect(const struct due_heap *heap, int64_t limit, uint32_t **ids, uint32_t *count) {
+    *ids = NULL;
+    *count = 0;
+    uint32_t *found = alloc(heap, (heap->count ? heap->count : 1) * sizeof(*found));
+    if (found == NULL) {
+        return -1;
+    }
+
+    // Breadth-first from the root: a node after limit has nothing due under
+    // it, so only the due part of the heap is visited. found doubles as the
+    // queue of heap indices.
+    uint32_t n = 0;
+    if (heap->count > 0 && heap->entries[0].when <= limit) {
+        found[n++] = 0;
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t child = 2 * found[k] + 1;
+        for (uint32_t c = child; c < child + 2 && c < heap->count; c++) {
+            if (heap->entries[c].when <= limit) {
+                found[n++] = c;
+            }
+        }
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        found[k] = heap->entries[found[k]].id;
+    }
+
+    *ids = found;
+    *count = n;
+    return 0;
+}
+
+void due_heap_update(struct due_heap *heap, uint32_t id, int64_t when) {
+    uint32_t i = heap->pos[id];
+    int64_t old = heap->entries[i].when;
+    heap->entries[i].when = when;
+    if (when < old) {
+        sift_up(heap, i);
+    } else if (when > old) {
+        sift_down(heap, i);
+    }
+}
+
+// Grow *array, of which used elements are kept, to hold at least want
+static int grow(const struct due_heap *heap, void **array, uint32_t *capacity, uint32_t used, uint32_t want,
+                size_t size) {
+    if (want <= *capacity) {
+        return 0;
+    }
+    uint32_t bigger = *capacity ? *capacity : 64;
+    while (bigger < want) {
+        bigger *= 2;
+    }
+    void *p;
+    if (heap->arena != NULL) {
+        p = pif_arena_alloc(heap->arena, bigger * size);
+        if (p != NULL && used > 0) {
+            memcpy(p, *array, used * size);
+        }
+    } else {
+        p = realloc(*array, bigger * size);
+    }
+    if (p == NULL) {
+        return -1;
+    }
+    *array = p;
+    *capacity = bigger;
+    return 0;
+}
+
+int due_heap_insert(struct due_heap *heap, uint32_t id, int64_t when) {
+    uint32_t ids = heap->ids;
+    if (grow(heap, (void **)&heap->pos, &heap->ids, ids, id + 1, sizeof(*heap->pos)) == -1) {
+        return -1;
+    }
+    memset(&heap->pos[ids], 0xff, (heap->ids - ids) * sizeof(*heap->pos));
+    uint32_t n = heap->count;
+    if (grow(heap, (void **)&heap->entries, &heap->capacity, n, n + 1, sizeof(*heap->entries)) == -1) {
+        return -1;
+    }
+    heap->entries[n] = (struct due_entry){ when, id };
+    heap->count = n + 1;
+    sift_up(heap, n);
+    return 0;
+}
+
+void due_heap_remove(struct due_heap *heap, uint32_t id) {
+    if (id >= heap->ids || heap->pos[id] == UINT32_MAX) {
+        return;
+    }
+    uint32_t i = heap->pos[id];
+    heap->pos[id] = UINT32_MAX;
+    struct due_entry last = heap->entries[--heap->count];
+    if (i == heap->count) {
+        return;
+    }
+
+    // The last entry fills the hole and moves whichever way it belongs
+    int64_t old = heap->entries[i].when;
+    place(heap, i, last);
+    if (last.when < old) {
+        sift_up(heap, i);
+    } else {
+        sift_down(heap, i);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Binary min-heap of (due time, id) pairs. Everything due by a given
+// time is found by walking only the part of the heap at or before it, and
+// an id's position is tracked so it can be moved or dropped in O(log n).
+// Ids are the library's stable song ids, so the heap is untouched when
+// other songs change row.
+struct due_entry {
+    int64_t when;
+    uint32_t id;
+};
+
+struct due_heap {
+    struct due_entry *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *pos;  // Heap index of each id, UINT32_MAX if not in the heap
+    uint32_t ids;   // Size of pos
+    struct pif_arena *arena;  // Where the arrays come from, NULL for malloc
+};
+
+// Drop the entries; arrays from an arena go with the arena
+void due_heap_free(struct due_heap *heap);
+
+// Replace the contents with entries in O(n). Ids must be below ids and
+// appear at most once; entries is copied.
+int due_heap_build(struct due_heap *heap, const struct due_entry *entries, uint32_t count, uint32_t ids);
+
+// Ids of every entry due at or before limit, in no particular order. The
+// heap is left as it is. The caller frees *ids unless the heap has an
+// arena.
+int due_heap_collect(const struct due_heap *heap, int64_t limit, uint32_t **ids, uint32_t *count);
+
+// Move id, which must be in the heap, to a new due time
+void due_heap_update(struct due_heap *heap, uint32_t id, int64_t when);
+
+// Add id, which must not be in the heap yet, due at when
+int due_heap_insert(struct due_heap *heap, uint32_t id, int64_t when);
+
+// Drop id if it is in the heap
+void due_heap_remove(struct due_heap *heap, uint32_t id);
+
+static inline const struct due_entry *due_heap_top(const struct due_heap *heap) {
+    return heap->count > 0 ? &heap->entries[0] : NULL;
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "state.h"
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define STATE_MAGIC "PIFS"
+#define STATE_VERSION 1
+#define STATE_SPINS 1000  // Odd reads before checking for a dead writer
+
+struct pif_state_file {
+    char magic[4];
+    uint32_t version;
+    _Atomic uint32_t seq;  // Odd while an update is being published
+    _Atomic int32_t songs_per_day;
+    _Atomic int32_t last_played;
+};
+
+static int lock(int fd, int op) {
+    while (flock(fd, op) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void publish(struct pif_state_file *file, const struct pif_config *config) {
+    uint32_t seq = atomic_load_explicit(&file->seq, memory_order_relaxed);
+    atomic_store_explicit(&file->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&file->songs_per_day, config->songs_per_day, memory_order_relaxed);
+    atomic_store_explicit(&file->last_played, config->last_played, memory_order_relaxed);
+    atomic_store_explicit(&file->seq, seq + 2, memory_order_release);
+}
+
+// Set up a new or unrecognised file, with the lock held
+static int initialise(int fd, const char *seed_path) {
+    struct pif_config config = PIF_CONFIG_INIT;
+    if (seed_path != NULL && pif_config_load(&config, seed_path) == -1) {
+        return -1;
+    }
+    struct pif_state_file file;
+    memset(&file, 0, sizeof(file));
+    memcpy(file.magic, STATE_MAGIC, 4);
+    file.version = STATE_VERSION;
+    atomic_init(&file.seq, 0);
+    atomic_init(&file.songs_per_day, config.songs_per_day);
+    atomic_init(&file.last_played, config.last_played);
+    if (pwrite(fd, &file, sizeof(file), 0) != (ssize_t)sizeof(file) || ftruncate(fd, sizeof(file)) == -1 ||
+        fsync(fd) == -1) {
+        return errno != 0 ? -1 : (errno = EIO, -1);
+    }
+    return 0;
+}
+
+static int open_state(struct pif_state *state, const char *path, const char *seed_path) {
+    state->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    state->file = NULL;
+    if (state->fd == -1) {
+        return -1;
+    }
+
+    // Only the first process to get here sets the file up
+    if (lock(state->fd, LOCK_EX) == -1) {
+        goto fail;
+    }
+    struct stat st;
+    struct pif_state_file head;
+    pif_trace_stats(1);
+    int valid = fstat(state->fd, &st) == 0 && st.st_size == (off_t)sizeof(head) &&
+                pread(state->fd, &head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                memcmp(head.magic, STATE_MAGIC, 4) == 0 && head.version == STATE_VERSION;
+    int rc = valid ? 0 : initialise(state->fd, seed_path);
+    int saved = errno;
+    flock(state->fd, LOCK_UN);
+    if (rc == -1) {
+        errno = saved;
+        goto fail;
+    }
+
+    void *map = mmap(NULL, sizeof(struct pif_state_file), PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    state->file = map;
+    return 0;
+
+fail:;
+    saved = errno;
+    close(state->fd);
+    state->fd = -1;
+    errno = saved;
+    return -1;
+}
+
+int pif_state_open(struct pif_state *state, const char *path, const char *seed_path) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = open_state(state, path, seed_path);
+    pif_trace_end(&span, PIF_PHASE_CONFIG);
+    return rc;
+}
+
+void pif_state_close(struct pif_state *state) {
+    if (state->file != NULL) {
+        munmap(state->file, sizeof(*state->file));
+    }
+    if (state->fd != -1) {
+        close(state->fd);
+    }
+    state->file = NULL;
+    state->fd = -1;
+}
+
+void pif_state_read(struct pif_state *state, struct pif_config *config) {
+    struct pif_state_file *file = state->file;
+    for (unsigned spins = 0;; spins++) {
+        uint32_t before = atomic_load_explicit(&file->seq, memory_order_acquire);
+        if (before & 1) {
+            // A writer that died mid-publish leaves the count odd for good.
+            // Once the lock is free nobody is writing, so settle it.
+            if (spins >= STATE_SPINS && lock(state->fd, LOCK_EX) == 0) {
+                uint32_t seq = atomic_load_explicit(&file->seq, memory_order_relaxed);
+                if (seq & 1) {
+                    atomic_store_explicit(&file->seq, seq + 1, memory_order_release);
+                }
+                flock(state->fd, LOCK_UN);
+                spins = 0;
+            }
+            sched_yield();
+            continue;
+        }
+        config->songs_per_day = atomic_load_explicit(&file->songs_per_day, memory_order_relaxed);
+        config->last_played = atomic_load_explicit(&file->last_played, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->seq, memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
+
+int pif_state_begin(struct pif_state *state, struct pif_config *config) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    int rc = lock(state->fd, LOCK_EX);
+    pif_trace_end(&span, PIF_PHASE_CONFIG);  // Mostly waiting for other writers
+    if (rc == -1) {
+        return -1;
+    }
+    // Nobody else can write now, but a dead writer may have left the
+    // count odd; publishing fixes that
+    struct pif_state_file *file = state->file;
+    config->songs_per_day = atomic_load_explicit(&file->songs_per_day, memory_order_relaxed);
+    config->last_played = atomic_load_explicit(&file->last_played, memory_order_relaxed);
+    return 0;
+}
+
+int pif_state_commit(struct pif_state *state, const struct pif_config *config) {
+    struct pif_trace_span span;
+    pif_trace_begin(&span);
+    struct pif_state_file *file = state->file;
+    uint32_t seq = atomic_load_explicit(&file->seq, memory_order_relaxed);
+    if (seq & 1) {
+        atomic_store_explicit(&file->seq, seq + 1, memory_order_relaxed);
+    }
+    publish(file, config);
+    flock(state->fd, LOCK_UN);
+
+    // Readers already see the update; this only makes it survive a crash
+    int rc = msync(file, sizeof(*file), MS_SYNC);
+    pif_trace_end(&span, PIF_PHASE_SAVE);
+    return rc;
+}
+
+void pif_state_abort(struct pif_state *state) {
+    flock(state->fd, LOCK_UN);
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATE_H
+#define STATE_H
+
+#include "libpif.h"
+
+// Rotation state shared by every pif process, kept in ~/.pif-state: a
+// small fixed-layout file that each process maps. Updates hold an
+// exclusive flock for their read-modify-write and publish through a
+// sequence counter, so readers take a consistent snapshot without
+// locking and never see half an update.
+#define PIF_STATE_NAME ".pif-state"
+
+struct pif_state_file;
+
+struct pif_state {
+    int fd;
+    struct pif_state_file *file;  // Shared mapping of the state file
+};
+
+// Map the state file at path. A missing or unrecognised file is created
+// from the legacy config at seed_path, or the defaults if there is none.
+// Returns 0 on success or -1 with errno set.
+int pif_state_open(struct pif_state *state, const char *path, const char *seed_path);
+void pif_state_close(struct pif_state *state);
+
+// Consistent snapshot of the current values; never blocks on a writer
+void pif_state_read(struct pif_state *state, struct pif_config *config);
+
+// Read-modify-write. pif_state_begin takes the lock and fills in the
+// current values; pif_state_commit publishes the changed ones and releases
+// it, pif_state_abort releases it without changes. Readers carry on
+// throughout.
+int pif_state_begin(struct pif_state *state, struct pif_config *config);
+int pif_state_commit(struct pif_state *state, const struct pif_config *config);
+void pif_state_abort(struct pif_state *state);
+
+#endif
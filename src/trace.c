@@ -0,0 +1,245 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
+
+int pif_trace_on;
+atomic_uint_fast64_t pif_trace_stat_calls;
+
+static const char *const phase_names[PIF_PHASE_COUNT] = {
+    "config", "parse", "rotation", "due", "save", "notify", "daemon",
+};
+
+struct phase_total {
+    uint64_t calls;
+    uint64_t ns;
+    struct pif_trace_io io;
+};
+
+static enum pif_trace_format trace_format;
+static int io_fd = -1;  // /proc/self/io, -1 if the kernel has none
+static atomic_uint_fast64_t self_reads;  // Our own reads of it, left out of the counts
+static atomic_uint_fast64_t self_bytes;
+static atomic_size_t malloc_peak;  // Sampled at phase boundaries
+static atomic_int_fast64_t arena_live;
+static atomic_int_fast64_t arena_peak;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t start_ns;
+static struct pif_trace_io start_io;
+static struct phase_total phases[PIF_PHASE_COUNT];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t field(const char *text, const char *name) {
+    const char *p = strstr(text, name);
+    return p != NULL ? strtoull(p + strlen(name), NULL, 10) : 0;
+}
+
+static void sample(struct pif_trace_io *io) {
+    memset(io, 0, sizeof(*io));
+    io->stat_calls = atomic_load_explicit(&pif_trace_stat_calls, memory_order_relaxed);
+    if (io_fd != -1) {
+        // The counts shown do not include this read yet, only earlier ones
+        uint64_t reads = atomic_load_explicit(&self_reads, memory_order_relaxed);
+        uint64_t bytes = atomic_load_explicit(&self_bytes, memory_order_relaxed);
+        char buf[512];
+        ssize_t n = pread(io_fd, buf, sizeof(buf) - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            io->bytes_read = field(buf, "rchar: ") - bytes;
+            io->bytes_written = field(buf, "wchar: ");
+            io->read_calls = field(buf, "syscr: ") - reads;
+            io->write_calls = field(buf, "syscw: ");
+            atomic_fetch_add_explicit(&self_bytes, (uint64_t)n, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&self_reads, 1, memory_order_relaxed);
+    }
+
+    struct mallinfo2 mi = mallinfo2();
+    size_t heap = mi.uordblks + mi.hblkhd;
+    size_t peak = atomic_load_explicit(&malloc_peak, memory_order_relaxed);
+    while (heap > peak && !atomic_compare_exchange_weak(&malloc_peak, &peak, heap)) {
+    }
+}
+
+void pif_trace_arena_slow(int64_t bytes) {
+    int_fast64_t live = atomic_fetch_add_explicit(&arena_live, bytes, memory_order_relaxed) + bytes;
+    int_fast64_t peak = atomic_load_explicit(&arena_peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak(&arena_peak, &peak, live)) {
+    }
+}
+
+static void io_add(struct pif_trace_io *sum, const struct pif_trace_io *end, const struct pif_trace_io *start) {
+    sum->read_calls += end->read_calls - start->read_calls;
+    sum->write_calls += end->write_calls - start->write_calls;
+    sum->bytes_read += end->bytes_read - start->bytes_read;
+    sum->bytes_written += end->bytes_written - start->bytes_written;
+    sum->stat_calls += end->stat_calls - start->stat_calls;
+}
+
+static void report_at_exit(void) {
+    pif_trace_report(stderr, NULL);
+}
+
+void pif_trace_init(enum pif_trace_format format, int report_on_exit) {
+    if (format == PIF_TRACE_OFF) {
+        const char *env = getenv("PIF_TRACE");
+        if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0) {
+            return;
+        }
+        format = strcmp(env, "json") == 0 ? PIF_TRACE_JSON : PIF_TRACE_TEXT;
+    }
+    trace_format = format;
+    io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    start_ns = now_ns();
+    sample(&start_io);
+    pif_trace_on = 1;
+    if (report_on_exit) {
+        atexit(report_at_exit);
+    }
+}
+
+// Both keep errno, since they run just before callers look at it
+void pif_trace_begin_slow(struct pif_trace_span *span) {
+    int saved = errno;
+    sample(&span->io);
+    span->start_ns = now_ns();
+    errno = saved;
+}
+
+void pif_trace_end_slow(struct pif_trace_span *span, enum pif_trace_phase phase) {
+    uint64_t end = now_ns();
+    int saved = errno;
+    struct pif_trace_io io;
+    sample(&io);
+    pthread_mutex_lock(&lock);
+    phases[phase].calls++;
+    phases[phase].ns += end - span->start_ns;
+    io_add(&phases[phase].io, &io, &span->io);
+    pthread_mutex_unlock(&lock);
+    errno = saved;
+}
+
+static void print_text(FILE *out, const char *label, double ms, const struct pif_trace_io *io, long max_rss) {
+    fprintf(out, "pif stats%s%s: %.3f ms, %llu stat calls, max RSS %ld KiB\n", label != NULL ? " for " : "",
+            label != NULL ? label : "", ms, (unsigned long long)io->stat_calls, max_rss);
+    fprintf(out, "  peak arena %lld bytes, peak malloc heap %zu bytes (sampled per phase)\n",
+            (long long)atomic_load(&arena_peak), atomic_load(&malloc_peak));
+    if (io_fd != -1) {
+        fprintf(out, "  %llu reads (%llu bytes), %llu writes (%llu bytes)\n", (unsigned long long)io->read_calls,
+                (unsigned long long)io->bytes_read, (unsigned long long)io->write_calls,
+                (unsigned long long)io->bytes_written);
+    }
+    fprintf(out, "  %-9s %6s %11s %7s %11s %7s %11s %6s\n", "phase", "calls", "ms", "reads", "read bytes",
+            "writes", "written", "stats");
+    for (int i = 0; i < PIF_PHASE_COUNT; i++) {
+        const struct phase_total *p = &phases[i];
+        if (p->calls == 0) {
+            continue;
+        }
+        fprintf(out, "  %-9s %6llu %11.3f %7llu %11llu %7llu %11llu %6llu\n", phase_names[i],
+                (unsigned long long)p->calls, (double)p->ns / 1e6, (unsigned long long)p->io.read_calls,
+                (unsigned long long)p->io.bytes_read, (unsigned long long)p->io.write_calls,
+                (unsigned long long)p->io.bytes_written, (unsigned long long)p->io.stat_calls);
+    }
+}
+
+static void print_io_json(FILE *out, const struct pif_trace_io *io) {
+    if (io_fd != -1) {
+        fprintf(out, "\"read_calls\":%llu,\"bytes_read\":%llu,\"write_calls\":%llu,\"bytes_written\":%llu,",
+                (unsigned long long)io->read_calls, (unsigned long long)io->bytes_read,
+                (unsigned long long)io->write_calls, (unsigned long long)io->bytes_written);
+    }
+    fprintf(out, "\"stat_calls\":%llu", (unsigned long long)io->stat_calls);
+}
+
+// Labels are command names, so they need no escaping
+static void print_json(FILE *out, const char *label, double ms, const struct pif_trace_io *io, long max_rss) {
+    fputc('{', out);
+    if (label != NULL) {
+        fprintf(out, "\"label\":\"%s\",", label);
+    }
+    fprintf(out, "\"ms\":%.3f,", ms);
+    print_io_json(out, io);
+    fprintf(out, ",\"arena_peak\":%lld,\"malloc_peak_sampled\":%zu,\"max_rss_kib\":%ld,\"phases\":{",
+            (long long)atomic_load(&arena_peak), atomic_load(&malloc_peak), max_rss);
+    const char *sep = "";
+    for (int i = 0; i < PIF_PHASE_COUNT; i++) {
+        const struct phase_total *p = &phases[i];
+        if (p->calls == 0) {
+            continue;
+        }
+        fprintf(out, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f,", sep, phase_names[i], (unsigned long long)p->calls,
+                (double)p->ns / 1e6);
+        print_io_json(out, &p->io);
+        fputc('}', out);
+        sep = ",";
+    }
+    fputs("}}\n", out);
+}
+
+void pif_trace_report(FILE *out, const char *label) {
+    if (!pif_trace_on) {
+        return;
+    }
+    struct pif_trace_io io, total = { 0 };
+    sample(&io);
+    uint64_t end = now_ns();
+    struct rusage usage;
+    long max_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+    pthread_mutex_lock(&lock);
+    io_add(&total, &io, &start_io);
+    double ms = (double)(end - start_ns) / 1e6;
+    if (trace_format == PIF_TRACE_JSON) {
+        print_json(out, label, ms, &total, max_rss);
+    } else {
+        print_text(out, label, ms, &total, max_rss);
+    }
+    pthread_mutex_unlock(&lock);
+    fflush(out);
+}
+
+void pif_trace_reset(void) {
+    if (!pif_trace_on) {
+        return;
+    }
+    struct mallinfo2 mi = mallinfo2();
+    atomic_store(&malloc_peak, mi.uordblks + mi.hblkhd);
+    atomic_store(&arena_peak, atomic_load(&arena_live));
+    pthread_mutex_lock(&lock);
+    memset(phases, 0, sizeof(phases));
+    start_ns = now_ns();
+    sample(&start_io);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Opt-in instrumentation for pif, pifd and pif-gtk: wall time per phase
+// and the I/O done meanwhile, with a report on stderr at exit. It is
+// turned on by --stats or by PIF_TRACE=1 (text) or PIF_TRACE=json. When
+// off, every hook is a single branch on a global flag.
+//
+// Read and write calls and byte counts come from /proc/self/io, minus
+// the reads of that file itself; stat calls are counted where the
+// library makes them. Phases can nest, e.g. a save that reloads the
+// library also counts as a parse.
+//
+// Memory is reported three ways: the peak of arena chunks, counted as
+// they are mapped and unmapped, so it is exact; the malloc heap, which
+// mallinfo2 only lets us sample at phase boundaries and so can miss a
+// short-lived peak; and the process's maximum RSS.
+
+enum pif_trace_phase {
+    PIF_PHASE_CONFIG,    // Rotation state and config
+    PIF_PHASE_PARSE,     // Loading the library and its snapshot
+    PIF_PHASE_ROTATION,  // Picking rotation songs
+    PIF_PHASE_DUE,       // Deciding which frequency songs are due
+    PIF_PHASE_SAVE,      // Writing state, journal, practice log or ~/.pif
+    PIF_PHASE_NOTIFY,    // Talking to the notification server
+    PIF_PHASE_DAEMON,    // Waiting for pifd's answer
+    PIF_PHASE_COUNT
+};
+
+enum pif_trace_format { PIF_TRACE_OFF, PIF_TRACE_TEXT, PIF_TRACE_JSON };
+
+struct pif_trace_io {
+    uint64_t read_calls;
+    uint64_t write_calls;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t stat_calls;
+};
+
+struct pif_trace_span {
+    uint64_t start_ns;
+    struct pif_trace_io io;
+};
+
+extern int pif_trace_on;
+extern atomic_uint_fast64_t pif_trace_stat_calls;
+
+// Turn tracing on in format, or as PIF_TRACE says if format is
+// PIF_TRACE_OFF. Unless report_at_exit is 0, the report is printed to
+// stderr when the process exits.
+void pif_trace_init(enum pif_trace_format format, int report_at_exit);
+
+void pif_trace_begin_slow(struct pif_trace_span *span);
+void pif_trace_end_slow(struct pif_trace_span *span, enum pif_trace_phase phase);
+
+static inline void pif_trace_begin(struct pif_trace_span *span) {
+    if (__builtin_expect(pif_trace_on, 0)) {
+        pif_trace_begin_slow(span);
+    }
+}
+
+static inline void pif_trace_end(struct pif_trace_span *span, enum pif_trace_phase phase) {
+    if (__builtin_expect(pif_trace_on, 0)) {
+        pif_trace_end_slow(span, phase);
+    }
+}
+
+// Count n stat-family calls
+static inline void pif_trace_stats(unsigned n) {
+    if (__builtin_expect(pif_trace_on, 0)) {
+        atomic_fetch_add_explicit(&pif_trace_stat_calls, n, memory_order_relaxed);
+    }
+}
+
+void pif_trace_arena_slow(int64_t bytes);
+
+// Count bytes mapped for an arena chunk, negative when unmapped
+static inline void pif_trace_arena(int64_t bytes) {
+    if (__builtin_expect(pif_trace_on, 0)) {
+        pif_trace_arena_slow(bytes);
+    }
+}
+
+// Print everything recorded so far, under label if not NULL. pifd
+// reports and resets per request.
+void pif_trace_report(FILE *out, const char *label);
+void pif_trace_reset(void);
+
+#endif
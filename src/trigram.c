@@ -0,0 +1,164 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "trigram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t fold(char c) {
+    return (uint32_t)(unsigned char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+static uint32_t key_at(const char *s) {
+    return ((fold(s[0]) << 16) | (fold(s[1]) << 8) | fold(s[2])) + 1;
+}
+
+static uint32_t slot_of(const struct trigram_index *index, uint32_t key) {
+    uint32_t mask = index->capacity - 1;
+    uint32_t i = (key * 2654435761u) & mask;
+    while (index->keys[i] != 0 && index->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int grow(struct trigram_index *index) {
+    uint32_t capacity = index->capacity ? index->capacity * 2 : 4096;
+    uint32_t *keys = calloc(capacity, sizeof(*keys));
+    struct trigram_list *lists = calloc(capacity, sizeof(*lists));
+    if (keys == NULL || lists == NULL) {
+        free(keys);
+        free(lists);
+        return -1;
+    }
+
+    struct trigram_index bigger = { keys, lists, capacity, index->used };
+    for (uint32_t i = 0; i < index->capacity; i++) {
+        if (index->keys[i] != 0) {
+            uint32_t slot = slot_of(&bigger, index->keys[i]);
+            keys[slot] = index->keys[i];
+            lists[slot] = index->lists[i];
+        }
+    }
+    free(index->keys);
+    free(index->lists);
+    *index = bigger;
+    return 0;
+}
+
+void trigram_free(struct trigram_index *index) {
+    for (uint32_t i = 0; i < index->capacity; i++) {
+        free(index->lists[i].ids);
+    }
+    free(index->keys);
+    free(index->lists);
+    memset(index, 0, sizeof(*index));
+}
+
+// First position in list not below id
+static uint32_t lower_bound(const struct trigram_list *list, uint32_t id) {
+    uint32_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (list->ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int list_insert(struct trigram_list *list, uint32_t id) {
+    // Ids usually arrive in order, so check the end first
+    uint32_t pos = list->count > 0 && list->ids[list->count - 1] < id ? list->count : lower_bound(list, id);
+    if (pos < list->count && list->ids[pos] == id) {
+        return 0;  // Trigram repeats within the name
+    }
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 4;
+        uint32_t *ids = realloc(list->ids, capacity * sizeof(*ids));
+        if (ids == NULL) {
+            return -1;
+        }
+        list->ids = ids;
+        list->capacity = capacity;
+    }
+    memmove(&list->ids[pos + 1], &list->ids[pos], (list->count - pos) * sizeof(*list->ids));
+    list->ids[pos] = id;
+    list->count++;
+    return 0;
+}
+
+int trigram_add(struct trigram_index *index, uint32_t id, const char *name, size_t len) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if ((index->used + 1) * 10 >= index->capacity * 7 && grow(index) == -1) {
+            return -1;
+        }
+        uint32_t key = key_at(name + i);
+        uint32_t slot = slot_of(index, key);
+        if (index->keys[slot] == 0) {
+            index->keys[slot] = key;
+            index->used++;
+        }
+        if (list_insert(&index->lists[slot], id) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Empty lists keep their slot; the trigram is likely to come back
+void trigram_remove(struct trigram_index *index, uint32_t id, const char *name, size_t len) {
+    if (index->capacity == 0) {
+        return;
+    }
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t slot = slot_of(index, key_at(name + i));
+        struct trigram_list *list = &index->lists[slot];
+        if (index->keys[slot] == 0) {
+            continue;
+        }
+        uint32_t pos = lower_bound(list, id);
+        if (pos < list->count && list->ids[pos] == id) {
+            memmove(&list->ids[pos], &list->ids[pos + 1], (list->count - pos - 1) * sizeof(*list->ids));
+            list->count--;
+        }
+    }
+}
+
+const uint32_t *trigram_candidates(const struct trigram_index *index, const char *query, size_t len,
+                                   uint32_t *count) {
+    *count = 0;
+    if (index->capacity == 0 || len < 3) {
+        return NULL;
+    }
+
+    const struct trigram_list *best = NULL;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t slot = slot_of(index, key_at(query + i));
+        if (index->keys[slot] == 0 || index->lists[slot].count == 0) {
+            return NULL;
+        }
+        if (best == NULL || index->lists[slot].count < best->count) {
+            best = &index->lists[slot];
+        }
+    }
+    *count = best->count;
+    return best->ids;
+}
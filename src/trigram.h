@@ -0,0 +1,57 @@
+/*
+ * This file is part of pif.
+ *
+ * pif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * pif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with pif.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Index from every three-byte window of a song name (ASCII case folded) to
+// the sorted list of song ids containing it. A substring query only has to
+// look at the songs in the shortest list among its own trigrams. Ids stay
+// put when other songs come and go, so no list is touched but the ones of
+// the name being added or removed.
+struct trigram_list {
+    uint32_t *ids;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct trigram_index {
+    uint32_t *keys;  // Trigram plus one, 0 for an empty slot
+    struct trigram_list *lists;
+    uint32_t capacity;  // Power of two, 0 if the index was never built
+    uint32_t used;
+};
+
+void trigram_free(struct trigram_index *index);
+
+// Record name under id. Ids may be added in any order.
+int trigram_add(struct trigram_index *index, uint32_t id, const char *name, size_t len);
+
+// Forget name under id
+void trigram_remove(struct trigram_index *index, uint32_t id, const char *name, size_t len);
+
+// Ids under the rarest trigram of query, in order, or NULL with *count
+// set to 0 if any trigram is missing. These are only candidates: the
+// caller still has to check each name. query must be at least 3 bytes
+// long. The list is owned by the index and valid until it next changes.
+const uint32_t *trigram_candidates(const struct trigram_index *index, const char *query, size_t len,
+                                   uint32_t *count);
+
+#endif